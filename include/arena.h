@@ -7,16 +7,35 @@ typedef struct {
     uint8_t* base;
     uint8_t* next;
     uint8_t* end;
+    /// The end of the address range reserved for the arena, which it can grow
+    /// into without moving.
+    uint8_t* limit;
 } Arena;
 
 bool arena_init(Arena* arena, size_t capacity);
+/// Initializes `arena` with room to grow up to `reserve` bytes in place.
+///
+/// Reserved memory is only committed once it is used.
+bool arena_init_reserved(Arena* arena, size_t capacity, size_t reserve);
 void arena_free(Arena* arena);
 
 size_t arena_capacity(Arena* arena);
+size_t arena_reserved(Arena* arena);
+bool arena_contains(Arena* arena, const void* ptr);
 
 uint8_t* arena_alloc(Arena* arena, size_t size, size_t align, size_t count);
 void arena_reset(Arena* arena);
 
+/// Resets `arena` and changes its capacity without moving it.
+///
+/// Returns `false` if `capacity` exceeds the reserved size.
+bool arena_resize(Arena* arena, size_t capacity);
+/// Resets `arena` and returns its memory to the operating system until it is
+/// used again.
+void arena_release(Arena* arena);
+/// Requests that `arena` be backed by transparent huge pages.
+void arena_advise_huge_pages(Arena* arena);
+
 #ifdef ENABLE_TESTS
 
 #include "test.h"
@@ -7,7 +7,20 @@
 #include "sexpr.h"
 #include "vm.h"
 
+/// A builtin whose arguments are evaluated before the call.
+///
+/// The values are passed in `args`, which the caller keeps rooted for the
+/// duration of the call, so calling a builtin doesn't allocate a list.
 typedef bool (*BuiltinFunc)(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+);
+
+/// A builtin whose arguments are passed unevaluated as the list `args`.
+typedef bool (*BuiltinFormFunc)(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
@@ -15,16 +28,45 @@ typedef bool (*BuiltinFunc)(
     SExpr** result
 );
 
-typedef struct {
+typedef struct BuiltinDef {
     s8 name;
     bool variadic_args;
+    // The number of arguments, or the least number of them if `variadic_args`
+    // is set.
     size_t arg_count;
 
     bool eval_args;
+    // Set when the builtin never evaluates anything itself, so that it doesn't
+    // need a frame of its own to run in.
+    bool leaf;
+    // Set when `form_func` leaves the form in tail position in `result`, for
+    // the caller to evaluate in the builtin's frame.
+    bool tail;
 
+    // Set when `eval_args` is true.
     BuiltinFunc func;
+    // Set when `eval_args` is false.
+    BuiltinFormFunc form_func;
 } BuiltinDef;
 
-bool lookup_builtin(s8 id, BuiltinDef* out);
+/// Returns the builtin named `id`, or `NULL` if there is none.
+///
+/// This scans every builtin, so prefer `lookup_builtin` for symbols.
+const BuiltinDef* find_builtin(s8 id);
+
+/// Returns the builtin named by `symbol`, or `NULL` if there is none.
+static inline const BuiltinDef* lookup_builtin(SExpr* symbol) {
+    return AS_SYMBOL(symbol)->builtin;
+}
+
+/// Returns `true` if `builtin` can be called with `arg_count` arguments.
+static inline bool builtin_accepts(
+    const BuiltinDef* builtin,
+    size_t arg_count
+) {
+    if (builtin->variadic_args) return arg_count >= builtin->arg_count;
+
+    return arg_count == builtin->arg_count;
+}
 
 #endif
@@ -5,6 +5,10 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Backs arenas with reserved virtual memory that is committed lazily, instead
+// of with `malloc`. Requires `mmap` and `madvise`.
+#define ENABLE_MMAP_ARENAS
+
 // Enables Valgrind support for any custom memory allocators in order to better
 // ensure correctness.
 // #define ENABLE_VALGRIND_SUPPORT
@@ -0,0 +1,25 @@
+#ifndef LISP_COMPILER_H
+#define LISP_COMPILER_H
+
+#include "common.h"
+#include "sexpr.h"
+#include "vm.h"
+
+/// Compiles the `(begin ...)` body of a function defined with `params` into
+/// code that runs it on a value stack with `vm_execute`.
+///
+/// A body that binds variables with `let` anywhere but in its own sequence of
+/// forms can't be compiled and is returned unchanged. Forms the compiler
+/// doesn't handle itself, such as `lambda` and `funcall`, are evaluated by
+/// `eval_internal` when the code runs.
+SExpr* compile_function(Vm* vm, SExpr* params, SExpr* body);
+
+#ifdef ENABLE_TESTS
+
+#include "test.h"
+
+extern TestList compiler_test_list;
+
+#endif
+
+#endif
@@ -7,8 +7,55 @@
 
 typedef struct EvalContext EvalContext;
 
+/// The kinds of errors evaluation reports through an `EvalContext`.
+typedef enum {
+    // An argument has an invalid type.
+    //
+    // `arg_index`, `sexpr`, and `sexpr_type` are active.
+    ARG_INVALID_TYPE,
+    // An argument to `cond` is not a pair.
+    //
+    // `arg_index` and `sexpr` are active.
+    COND_ARG_NOT_PAIR,
+    // An argument list is dotted.
+    //
+    // `arg_index` and `sexpr` are active.
+    DOTTED_ARG_LIST,
+    // The number of arguments to a function is either less than or greater
+    // than the defined number.
+    //
+    // `arg_index` is active and is the required number of arguments.
+    ERRONOUS_ARG_COUNT,
+    // The function call is illegal.
+    //
+    // `sexpr` is active.
+    ILLEGAL_FUNC_CALL,
+    // An argument is a number that isn't a valid index or length.
+    //
+    // `arg_index` and `sexpr` are active.
+    INDEX_OUT_OF_RANGE,
+    // An argument defined in function is not a symbol.
+    //
+    // `arg_index` and `sexpr` are active.
+    INVALID_ARG_DEF_TYPE,
+    // Lookup of a function or a variable failed.
+    //
+    // `sexpr` is active.
+    SYMBOL_LOOKUP_FAILED,
+    // The maximum stack depth allowed was reached.
+    MAX_STACK_DEPTH_REACHED,
+    // The heap limit was reached.
+    OUT_OF_MEMORY,
+} EvalErrorType;
+
 EvalContext* eval_context_alloc(Vm* vm);
 bool eval_context_is_ok(EvalContext* context);
+/// Returns the kind of error reported to `context`, which must have one.
+EvalErrorType eval_context_error(const EvalContext* context);
+/// Returns the argument the error is about, or the required number of
+/// arguments for `ERRONOUS_ARG_COUNT`. Errors that don't report one leave it
+/// at `0`.
+size_t eval_context_arg_index(const EvalContext* context);
 void eval_context_disable_local_env(EvalContext* context);
 void eval_context_add_symbol(
     Vm* vm,
@@ -23,22 +70,71 @@ bool eval_context_lookup(
     SExpr** result
 );
 
-void eval_context_push_frame(Vm* vm, EvalContext* context, SExpr* id);
-void eval_context_pop_frame(EvalContext* context);
+/// Returns the value of a resolved parameter reference.
+bool eval_context_lookup_local(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* local,
+    SExpr** result
+);
+
+/// Pushes a frame with a slot for each parameter in `params`, which is `NIL`
+/// for builtins.
+void eval_context_push_frame(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr* params
+);
+/// Binds the parameters of the current frame to the array `values`, making
+/// them visible to lookups.
+void eval_context_bind_locals(Vm* vm, EvalContext* context, SExpr** values);
+/// Returns `true` if the current frame has bound exactly `params`.
+bool eval_context_binds(EvalContext* context, SExpr* params);
+/// Returns the value of parameter `slot` of the nearest frame whose
+/// parameters are bound, which must have that many.
+SExpr* eval_context_local(EvalContext* context, size_t slot);
+/// Removes the frame below the current one, returning `true` if it did.
+///
+/// This is only done if the frame below is a function's frame whose bindings
+/// are all shadowed by the parameters of the current one, so that no lookup
+/// can tell that it is gone.
+bool eval_context_replace_caller(Vm* vm, EvalContext* context);
+/// Removes every frame between the current one and the outermost `depth`
+/// frames, which the current frame then takes the place of.
+///
+/// Nothing is removed unless the current frame is a function's frame whose
+/// parameters are bound. It keeps whatever the removed frames bind and it
+/// doesn't, so lookups from it find the same values as before.
+void eval_context_replace_callers(
+    Vm* vm,
+    EvalContext* context,
+    size_t depth
+);
+void eval_context_pop_frame(Vm* vm, EvalContext* context);
+/// Pops frames until `depth` are left, unless an error was reported.
+void eval_context_pop_frames(Vm* vm, EvalContext* context, size_t depth);
 size_t eval_context_stack_depth(EvalContext* context);
+/// Returns `true` if another frame may be pushed, and otherwise reports that
+/// the maximum stack depth of `vm` was reached. Running out of native stack
+/// is reported the same way.
+bool eval_context_check_depth(Vm* vm, EvalContext* context);
 
 void eval_context_invalid_type(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* arg,
     SExprType type
 );
 void eval_context_cond_arg_not_pair(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* not_pair
 );
 void eval_context_dotted_arg_list(
+    Vm* vm,
     EvalContext* context,
     size_t dotted_start,
     SExpr* arg_list
@@ -48,19 +144,29 @@ void eval_context_erronous_arg_count(
     size_t required_arg_count
 );
 void eval_context_illegal_call(
+    Vm* vm,
     EvalContext* context,
     SExpr* sexpr
 );
+void eval_context_index_out_of_range(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_index,
+    SExpr* index
+);
 void eval_context_invalid_arg_def_type(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* arg_def
 );
 void eval_context_symbol_lookup_failed(
+    Vm* vm,
     EvalContext* context,
     SExpr* sexpr
 );
 void eval_context_max_stack_depth_reached(EvalContext* context);
+void eval_context_out_of_memory(EvalContext* context);
 
 void eval_context_print(const EvalContext* context);
 void eval_context_print_raw(const EvalContext* context);
@@ -1,7 +1,7 @@
 #ifndef LISP_EVAL_IMPL_H
 #define LISP_EVAL_IMPL_H
 
-bool validate_function_def(EvalContext* context, SExpr* def);
+bool validate_function_def(Vm* vm, EvalContext* context, SExpr* def);
 
 bool eval_internal(
     Vm* vm,
@@ -19,4 +19,13 @@ bool eval_func(
     SExpr** result
 );
 
+/// Calls the function value `closure` with the unevaluated `args`.
+bool eval_closure(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* closure,
+    SExpr* args,
+    SExpr** result
+);
+
 #endif
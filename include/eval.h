@@ -20,6 +20,23 @@ EvalResult eval(Vm* vm, SExpr* sexpr);
 
 #include "test.h"
 
+/// Evaluates each expression of `input` in turn, returning the result of the
+/// first one that fails or of the last one.
+EvalResult eval_test_result(Vm* vm, s8 input);
+/// Like `eval_test_result`, but returns the value of the last expression, or
+/// `NIL` if evaluation failed.
+SExpr* eval_test_run(Vm* vm, s8 input);
+/// Returns `true` if `input` evaluates to the number `expected`.
+bool eval_test_number(Vm* vm, s8 input, double expected);
+/// Returns `true` if `input` fails with `error` about argument `arg_index`,
+/// which is `0` for errors that aren't about an argument.
+bool eval_test_fails_with(
+    Vm* vm,
+    s8 input,
+    EvalErrorType error,
+    size_t arg_index
+);
+
 extern TestList eval_test_list;
 
 #endif
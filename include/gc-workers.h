@@ -0,0 +1,76 @@
+#ifndef LISP_GC_WORKERS_H
+#define LISP_GC_WORKERS_H
+
+#include <pthread.h>
+
+#include "common.h"
+
+/// The objects waiting to be scanned by one worker.
+///
+/// The owning worker takes items from the back of its queue, while idle
+/// workers steal from the front.
+typedef struct {
+    pthread_mutex_t lock;
+    void** items;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+} GcWorkQueue;
+
+typedef struct GcWorkers GcWorkers;
+typedef struct GcWorkerThread GcWorkerThread;
+
+/// Run by every worker for each call to `gc_workers_run`.
+typedef void (*GcWorkerTask)(GcWorkers* workers, size_t index, void* context);
+
+/// A pool of threads that share the work of a collection.
+///
+/// The thread calling `gc_workers_run` acts as worker zero, so a pool of
+/// `count` workers only starts `count - 1` threads.
+struct GcWorkers {
+    size_t count;
+    GcWorkerThread* threads;
+    GcWorkQueue* queues;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finish;
+    size_t generation;
+    size_t running;
+    bool shutdown;
+
+    GcWorkerTask task;
+    void* context;
+
+    // The number of workers that found every queue empty.
+    size_t idle;
+};
+
+/// Starts a pool of `count` workers.
+bool gc_workers_init(GcWorkers* workers, size_t count);
+void gc_workers_free(GcWorkers* workers);
+
+/// Runs `task` on every worker, returning once they have all finished.
+void gc_workers_run(GcWorkers* workers, GcWorkerTask task, void* context);
+
+/// Queues `item` to be taken by the worker with the given index.
+///
+/// Must only be called by that worker during `gc_workers_run`.
+void gc_workers_push(GcWorkers* workers, size_t index, void* item);
+
+/// Takes the next item for the worker with the given index, stealing from the
+/// other workers once its own queue is empty.
+///
+/// Returns `NULL` once every queue is empty and every worker is waiting for
+/// work, since no more items can be pushed at that point.
+void* gc_workers_take(GcWorkers* workers, size_t index);
+
+#ifdef ENABLE_TESTS
+
+#include "test.h"
+
+extern TestList gc_workers_test_list;
+
+#endif
+
+#endif
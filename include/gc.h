@@ -2,61 +2,189 @@
 #define LISP_GC_H
 
 #include <setjmp.h>
+#include <stdio.h>
 
 #include "common.h"
 #include "arena.h"
+#include "gc-workers.h"
+#include "util.h"
 
 typedef struct Gc Gc;
+typedef struct GcLargeObject GcLargeObject;
 
+/// The header of every object managed by the collector.
+///
+/// Holds the type id and collector flags of the object, or the address of its
+/// copy with the low bit set once the object has been forwarded.
 typedef struct GcObject GcObject;
 struct GcObject {
-    size_t flags;
-    GcObject* forward_ptr;
+    size_t header;
 };
 
 size_t gc_object_type(GcObject* object);
 
 typedef size_t (*GcObjectSize)(GcObject* object);
-typedef void (*GcCopyObject)(
-    Gc* gc,
-    GcObject* object,
-    GcObject* new_object
-);
-typedef GcObject* (*GcGetChildren)(GcObject* object, GcObject* position);
+/// Updates every object reference held by `object` using `GC_SCAN_FIELD`.
+///
+/// The collector copies the bytes of an object itself, so this is only called
+/// on the new copy of an object once it has been placed into to-space.
+typedef void (*GcScanObject)(Gc* gc, GcObject* object);
 
 typedef struct {
     size_t align;
     GcObjectSize object_size;
-    GcCopyObject copy_object;
-    GcGetChildren get_children;
+    GcScanObject scan_object;
 } GcType;
 
+/// Controls how the old generation is sized.
+typedef struct {
+    /// The capacity of each semispace when the heap is created.
+    size_t initial_size;
+    /// The factor by which a semispace grows when it runs out of space.
+    double growth_factor;
+    /// The fraction of a semispace that live data should occupy after a full
+    /// collection.
+    double target_live_ratio;
+    /// The number of consecutive full collections that must find the heap
+    /// underused before it is shrunk.
+    size_t shrink_after;
+    /// The maximum number of bytes reserved by the heap, or zero for no limit.
+    size_t max_heap_size;
+    /// Whether the semispaces should be backed by transparent huge pages.
+    bool huge_pages;
+    /// The number of threads that copy objects during a full collection.
+    size_t threads;
+} GcConfig;
+
+void gc_config_default(GcConfig* config);
+bool gc_config_is_valid(const GcConfig* config);
+
+#define GC_PAUSE_BUCKET_COUNT 24
+/// The number of object types a collector can register.
+#define GC_MAX_TYPE_COUNT 32
+
+/// Counters maintained by the collector.
+typedef struct {
+    size_t minor_collections;
+    size_t major_collections;
+
+    size_t bytes_allocated;
+    /// Bytes copied by full collections or promoted by minor collections.
+    size_t bytes_copied;
+    /// The number of objects of each type that survived a collection.
+    size_t survivors[GC_MAX_TYPE_COUNT];
+
+    /// The number of bytes currently reserved by the heap.
+    size_t heap_size;
+    size_t peak_heap_size;
+    /// The number of bytes held by objects in the large object space.
+    size_t large_object_size;
+
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    /// Bucket `i` counts pauses that took less than `2^(i + 1)` microseconds,
+    /// and at least `2^i` microseconds if `i` isn't zero. The last bucket also
+    /// counts every longer pause.
+    size_t pause_histogram[GC_PAUSE_BUCKET_COUNT];
+} GcStats;
+
+/// A block of roots pushed onto the shadow stack by `GC_FRAME_BEGIN`.
+typedef struct GcFrame GcFrame;
+struct GcFrame {
+    GcFrame* prev;
+    size_t count;
+    void** slots;
+};
+
 struct Gc {
     bool collecting;
+    bool minor;
 
+    // The old generation is a pair of semispaces.
     Arena active;
     Arena inactive;
 
+    // New objects are bump allocated in the nursery and promoted into the old
+    // generation when they survive a minor collection.
+    Arena nursery;
+    size_t nursery_slack;
+
+    // The worst-case alignment padding needed to copy the old generation.
+    size_t old_slack;
+
+    // Objects too large to copy cheaply are allocated individually and are
+    // marked and swept by full collections instead.
+    GcLargeObject* large_objects;
+    // Marked large objects whose children haven't been forwarded yet.
+    GcLargeObject* gray_objects;
+    size_t large_size;
+    // The size the large object space may reach before a full collection.
+    size_t large_limit;
+
+    // Old objects that may reference objects in the nursery.
+    GcObject** remembered;
+    size_t remembered_count;
+    size_t remembered_capacity;
+
     GcObject*** roots;
     size_t root_count;
     size_t root_capacity;
 
+    // The innermost frame of the shadow stack.
+    GcFrame* frames;
+
     GcType* types;
     size_t type_count;
     size_t type_capacity;
 
     jmp_buf collect_mark;
+
+    GcConfig config;
+    size_t max_semispace_size;
+    size_t underused_count;
+
+    // Threads that share the work of full collections. Collections are only
+    // parallel if there is more than one worker.
+    GcWorkers workers;
+    // Guards the claiming of to-space by parallel collection threads.
+    pthread_mutex_t to_space_lock;
+
+    // Forwarding overwrites the header of the original object, so a full
+    // collection that might run out of to-space records every original it
+    // forwards in order to be able to undo the collection.
+    bool log_forwarding;
+    GcObject** forwarded;
+    size_t forwarded_count;
+    size_t forwarded_capacity;
+
+    // Jumped to when an allocation can't be satisfied within the heap limit.
+    // If `NULL`, running out of memory aborts the process.
+    jmp_buf* oom_handler;
+
+    GcStats stats;
+
+#ifdef DEBUG_STRESS_GC
+    size_t stress_count;
+    // Skips the forced collections, for tests whose heaps are too large to
+    // collect on every allocation.
+    bool stress_paused;
+#endif
 };
 
-bool gc_init(Gc* gc);
+/// Initializes `gc` using `config`, or the default configuration if `config`
+/// is `NULL`.
+///
+/// Returns `false` if the configuration is invalid or allocation fails.
+bool gc_init(Gc* gc, const GcConfig* config);
 void gc_free(Gc* gc);
 
+void gc_print_stats(Gc* gc, FILE* file);
+
 size_t gc_add_type(
     Gc* gc,
     size_t align,
     GcObjectSize object_size,
-    GcCopyObject copy_object,
-    GcGetChildren get_children
+    GcScanObject scan_object
 );
 
 /// Strong roots must not be added or removed during a garbage collection.
@@ -79,9 +207,54 @@ void gc_unroot(Gc* gc, GcObject** root);
 
 #endif
 
+/// Roots each of the given object pointers until the matching `GC_FRAME_END`.
+///
+/// Frames must be ended in the reverse order that they were begun and at most
+/// one frame may be begun per scope. Unlike `GC_ROOT`, pushing and popping a
+/// frame doesn't require a call into the collector, so frames should be
+/// preferred for roots that follow the call stack.
+#define GC_FRAME_BEGIN(gc, ...) \
+    void* gc_frame_slots[] = { __VA_ARGS__ }; \
+    GcFrame gc_frame = { \
+        (gc)->frames, \
+        sizeof(gc_frame_slots) / sizeof(gc_frame_slots[0]), \
+        gc_frame_slots \
+    }; \
+    (gc)->frames = &gc_frame
+
+#define GC_FRAME_END(gc) do { \
+    ASSERT((gc)->frames == &gc_frame, "gc frames must be ended in order"); \
+    (gc)->frames = gc_frame.prev; \
+} while (0)
+
+/// Records that a reference has been stored into `object`.
+///
+/// Must be called whenever a reference is stored into an object after its
+/// initialization, so that minor collections can find references from the
+/// old generation into the nursery.
+#define GC_WRITE_BARRIER(gc, object) \
+    gc_write_barrier((gc), (GcObject*) (object))
+
+void gc_write_barrier(Gc* gc, GcObject* object);
+
 void gc_collect(Gc* gc);
 
-GcObject* gc_copy_object(Gc* gc, GcObject* object);
+/// Forwards the object referenced by `field` into to-space, updating `field`.
+///
+/// Must only be called from a `GcScanObject` callback. `NULL` fields and
+/// immediate values are ignored.
+#define GC_SCAN_FIELD(gc, field) gc_scan_field((gc), (GcObject**) &(field))
+
+void gc_scan_field(Gc* gc, GcObject** field);
+
+/// References with any of these bits set are immediate values rather than
+/// objects, and are left untouched by the collector.
+#define GC_IMMEDIATE_MASK ((uintptr_t) 7)
+
+/// Returns whether `ref` refers to an object managed by the collector.
+static inline bool gc_is_object(const void* ref) {
+    return ref != NULL && ((uintptr_t) ref & GC_IMMEDIATE_MASK) == 0;
+}
 
 GcObject* gc_alloc(Gc* gc, size_t type_id, size_t size);
 void* gc_alloc_untyped(Gc* gc, size_t size, size_t align);
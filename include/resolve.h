@@ -0,0 +1,24 @@
+#ifndef LISP_RESOLVE_H
+#define LISP_RESOLVE_H
+
+#include "common.h"
+#include "sexpr.h"
+#include "vm.h"
+
+/// Returns `body` with each reference to one of `params` replaced by a local
+/// that reads the parameter's slot in the function's frame.
+///
+/// Parameters rebound by a `let` within `body`, quoted data, and the bodies of
+/// nested `lambda` and `define` forms are left to be looked up by name. Only
+/// the parts of `body` that change are copied.
+SExpr* resolve_locals(Vm* vm, SExpr* params, SExpr* body);
+
+#ifdef ENABLE_TESTS
+
+#include "test.h"
+
+extern TestList resolve_test_list;
+
+#endif
+
+#endif
@@ -21,6 +21,9 @@ uint8_t s8_index(s8, size_t index);
 /// Returns `true` if the first string equals the second.
 bool s8_equals(s8, s8);
 
+/// Returns the FNV-1a hash of the string.
+size_t s8_hash(s8);
+
 /// Copies the contents of `from` into `to`.
 ///
 /// # Safety
@@ -10,14 +10,23 @@ typedef enum {
     SEXPR_STRING,
     SEXPR_NUMBER,
     SEXPR_CONS,
+    SEXPR_LOCAL,
+    SEXPR_CODE,
+    SEXPR_CLOSURE,
+    SEXPR_VECTOR,
 } SExprType;
 
 typedef struct SExpr {
     GcObject object;
 } SExpr;
 
+struct BuiltinDef;
+
 typedef struct {
     SExpr header;
+    size_t hash;
+    // The builtin the symbol names, if any, found when it was interned.
+    const struct BuiltinDef* builtin;
     size_t len;
     uint8_t bytes[];
 } SExprSymbol;
@@ -39,8 +48,130 @@ typedef struct {
     SExpr* cdr;
 } SExprCons;
 
+/// A reference to a function parameter that was resolved to its slot in the
+/// function's frame when the function was defined.
+typedef struct {
+    SExpr header;
+    SExpr* symbol;
+    size_t slot;
+} SExprLocal;
+
+/// The bytecode a function body was compiled to.
+///
+/// The instructions follow the constants they refer to. The code prints as
+/// the body it was compiled from.
+typedef struct {
+    SExpr header;
+    SExpr* source;
+    // The parameters of the function the body was compiled for, which must be
+    // bound in the current frame when the code is run.
+    SExpr* params;
+    // The number of values the code pushes onto the value stack at most.
+    size_t max_stack;
+    size_t length;
+    // The last `cache_count` constants cache the closures called by the
+    // code, and start out as `NIL`.
+    size_t cache_count;
+    // The value of `Vm.funcs_epoch` when the caches were last valid.
+    size_t epoch;
+    size_t constant_count;
+    SExpr* constants[];
+} SExprCode;
+
+/// A function value, as created by `lambda`, `define` and `function`.
+///
+/// The parameters are validated when the closure is created, so calling it
+/// doesn't check them again. Variables are scoped dynamically, so no
+/// environment is captured. The closure prints as the list `('function id
+/// params body)` that functions were represented by before.
+typedef struct {
+    SExpr header;
+    // The name of the function, or the `(lambda ...)` expression it was
+    // created from.
+    SExpr* id;
+    // `NIL` for builtins.
+    SExpr* params;
+    SExpr* body;
+    // The number of parameters.
+    size_t arity;
+} SExprClosure;
+
+/// A fixed number of values stored next to each other, so that any of them
+/// can be reached in constant time. The vector prints as `#(a b c)`.
+typedef struct {
+    SExpr header;
+    size_t len;
+    SExpr* items[];
+} SExprVector;
+
 #define NIL ((SExpr*) NULL)
 
+// On 64-bit targets, most numbers are stored in the `SExpr*` itself instead of
+// being allocated.
+//
+// A double whose exponent lies roughly within 2^-255 to 2^256 is rotated left
+// by three bits. The top two exponent bits then land in the two low bits,
+// where they can be replaced by a tag, since the third exponent bit
+// determines them. Positive zero is given its own encoding. Every other
+// number is still allocated.
+#if UINTPTR_MAX > UINT32_MAX
+#define SEXPR_IMMEDIATE_NUMBERS
+#endif
+
+#define SEXPR_NUMBER_TAG ((uintptr_t) 2)
+#define SEXPR_NUMBER_TAG_MASK ((uintptr_t) 3)
+
+#ifdef SEXPR_IMMEDIATE_NUMBERS
+
+#define SEXPR_IMMEDIATE_ZERO (((uint64_t) 1 << 63) | SEXPR_NUMBER_TAG)
+
+typedef union {
+    double number;
+    uint64_t bits;
+} SExprNumberBits;
+
+#define IS_IMMEDIATE_NUMBER(sexpr) \
+    (((uintptr_t) (sexpr) & SEXPR_NUMBER_TAG_MASK) == SEXPR_NUMBER_TAG)
+
+/// Encodes `number` as an immediate value if it is within range.
+static inline bool sexpr_encode_number(double number, SExpr** sexpr) {
+    SExprNumberBits value = { number };
+    uint64_t exponent_bits = (value.bits >> 60) & 7;
+
+    if (value.bits == 0) {
+        *sexpr = (SExpr*) (uintptr_t) SEXPR_IMMEDIATE_ZERO;
+        return true;
+    }
+
+    // Only 011 and 100 can be recovered from their lowest bit, and the
+    // smallest such number would be encoded the same as zero.
+    if (((exponent_bits - 3) & ~(uint64_t) 1) != 0) return false;
+    if (value.bits == (uint64_t) 3 << 60) return false;
+
+    uint64_t rotated = (value.bits << 3) | (value.bits >> 61);
+    rotated = (rotated & ~(uint64_t) 1) | SEXPR_NUMBER_TAG;
+    *sexpr = (SExpr*) (uintptr_t) rotated;
+    return true;
+}
+
+static inline double sexpr_decode_number(const SExpr* sexpr) {
+    uint64_t bits = (uint64_t) (uintptr_t) sexpr;
+    if (bits == SEXPR_IMMEDIATE_ZERO) return 0.0;
+
+    // Restore the top two exponent bits from the third.
+    uint64_t rotated = (2 - (bits >> 63)) | (bits & ~SEXPR_NUMBER_TAG_MASK);
+
+    SExprNumberBits value;
+    value.bits = (rotated >> 3) | (rotated << 61);
+    return value.number;
+}
+
+#else
+
+#define IS_IMMEDIATE_NUMBER(sexpr) false
+
+#endif
+
 #define AS_SYMBOL(sexpr) \
     ((SExprSymbol*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_SYMBOL))
 #define AS_STRING(sexpr) \
@@ -49,17 +180,30 @@ typedef struct {
     ((SExprNumber*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_NUMBER))
 #define AS_CONS(sexpr) \
     ((SExprCons*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_CONS))
+#define AS_LOCAL(sexpr) \
+    ((SExprLocal*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_LOCAL))
+#define AS_CODE(sexpr) \
+    ((SExprCode*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_CODE))
+#define AS_CLOSURE(sexpr) \
+    ((SExprClosure*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_CLOSURE))
+#define AS_VECTOR(sexpr) \
+    ((SExprVector*) sexpr_check_cast((SExpr*) (sexpr), SEXPR_VECTOR))
 
 #define IS_NIL(sexpr) ((sexpr) == NIL)
 #define IS_SYMBOL(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_SYMBOL)
 #define IS_STRING(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_STRING)
 #define IS_NUMBER(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_NUMBER)
 #define IS_CONS(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_CONS)
+#define IS_LOCAL(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_LOCAL)
+#define IS_CODE(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_CODE)
+#define IS_CLOSURE(sexpr) \
+    (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_CLOSURE)
+#define IS_VECTOR(sexpr) (sexpr_extract_type((SExpr*) (sexpr)) == SEXPR_VECTOR)
 
 #define EXTRACT_TYPE(sexpr) sexpr_extract_type((SExpr*) (sexpr))
 #define EXTRACT_SYMBOL(sexpr) sexpr_s8((SExpr*) AS_SYMBOL(sexpr))
 #define EXTRACT_STRING(sexpr) sexpr_s8((SExpr*) AS_STRING(sexpr))
-#define EXTRACT_NUMBER(sexpr) (AS_NUMBER(sexpr)->number)
+#define EXTRACT_NUMBER(sexpr) sexpr_number((SExpr*) (sexpr))
 #define EXTRACT_CAR(sexpr) (AS_CONS(sexpr)->car)
 #define EXTRACT_CDR(sexpr) (AS_CONS(sexpr)->cdr)
 
@@ -71,6 +215,18 @@ SExprType sexpr_extract_type(const SExpr* sexpr);
 const SExpr* sexpr_check_cast(const SExpr* sexpr, SExprType type);
 s8 sexpr_s8(const SExpr* sexpr);
 
+static inline double sexpr_number(const SExpr* sexpr) {
+#ifdef SEXPR_IMMEDIATE_NUMBERS
+    if (IS_IMMEDIATE_NUMBER(sexpr)) return sexpr_decode_number(sexpr);
+#endif
+    return AS_NUMBER(sexpr)->number;
+}
+
+/// Returns the instructions of `code`, which are stored after its constants.
+static inline uint8_t* sexpr_code_bytes(SExprCode* code) {
+    return (uint8_t*) &code->constants[code->constant_count];
+}
+
 void sexpr_print(const SExpr* sexpr);
 void sexpr_print_raw(const SExpr* sexpr, size_t tab_count);
 
@@ -10,32 +10,248 @@ typedef struct {
     SExpr* list;
 } Environment;
 
+/// An open-addressing hash table of every symbol created by a `Vm`.
+///
+/// Each symbol name is only ever allocated once, so symbols can be compared
+/// by pointer.
+typedef struct {
+    GcObject object;
+
+    size_t count;
+    // Always a power of two.
+    size_t capacity;
+    SExpr* symbols[];
+} SymbolTable;
+
+typedef struct {
+    SExpr* symbol;
+    SExpr* value;
+} EnvEntry;
+
+/// An open-addressing hash table mapping interned symbols to values, used for
+/// the global environments.
+typedef struct {
+    GcObject object;
+
+    size_t count;
+    // Always a power of two.
+    size_t capacity;
+    EnvEntry entries[];
+} EnvTable;
+
+/// A chunk of the value stack of a `Vm`.
+///
+/// Chunks never move, so values keep their address while they're on the
+/// stack.
+typedef struct VmValueChunk VmValueChunk;
+struct VmValueChunk {
+    VmValueChunk* prev;
+    // The number of values on the stack below this chunk.
+    size_t base;
+    size_t count;
+    size_t capacity;
+    // `slots[i]` points to `values[i]`, so that a `GcFrame` can root a range
+    // of values without a slot array of its own.
+    void** slots;
+    SExpr* values[];
+};
+
+/// The number of values in the first chunk of the value stack, and the least
+/// any chunk holds.
+#define VM_VALUE_CHUNK_SIZE 1024
+
+/// The default for `Vm.max_stack_depth`.
+#define VM_DEFAULT_MAX_STACK_DEPTH 4096
+/// The native stack size assumed when the system doesn't limit it.
+#define VM_DEFAULT_NATIVE_STACK_SIZE (8 * 1024 * 1024)
+
 typedef struct {
     Gc gc;
 
-    Environment vars;
-    Environment funcs;
+    // The number of frames at which evaluation stops with an error.
+    size_t max_stack_depth;
+    // Evaluation recurses on the native stack, so it also stops once it is
+    // more than `native_stack_limit` bytes away from where the VM was
+    // initialized, whatever `max_stack_depth` allows.
+    uintptr_t native_stack_base;
+    size_t native_stack_limit;
+
+    // Values that the calls in progress hold onto, like their arguments.
+    VmValueChunk* values;
+    // The most recently emptied chunk, kept so that a call that pushes many
+    // values in a loop doesn't allocate a chunk each time.
+    VmValueChunk* spare_values;
+
+    SymbolTable* symbols;
+    // Symbols that evaluation produces or tests for, interned up front so
+    // they're never looked up by name.
+    SExpr* t_symbol;
+    SExpr* lambda_symbol;
+    SExpr* begin_symbol;
+
+    EnvTable* vars;
+    EnvTable* funcs;
+    // Incremented whenever a function is defined, which invalidates the
+    // closures cached by compiled code.
+    size_t funcs_epoch;
 } Vm;
 
-bool vm_init(Vm* vm);
+/// Returns `true` if the caller is within `native_stack_limit` bytes of the
+/// native stack the VM was initialized on.
+static inline bool vm_native_stack_available(const Vm* vm) {
+    char marker;
+    uintptr_t here = (uintptr_t) &marker;
+    uintptr_t base = vm->native_stack_base;
+    size_t used = here < base ? base - here : here - base;
+    return used < vm->native_stack_limit;
+}
+
+bool vm_init(Vm* vm, const GcConfig* config);
 void vm_free(Vm* vm);
 
+/// Pushes `count` values onto the value stack of `vm` and sets them to `NIL`.
+///
+/// The values are rooted by `frame`, which becomes the innermost GC frame,
+/// until they're popped with `vm_pop_values`.
+SExpr** vm_push_values(Vm* vm, GcFrame* frame, size_t count);
+/// Pops the values pushed with `frame`, which must be the innermost GC frame.
+void vm_pop_values(Vm* vm, GcFrame* frame);
+/// Returns the number of values on the value stack of `vm`.
+size_t vm_value_count(const Vm* vm);
+/// Pops values until only `count` are left, for when evaluation is unwound
+/// without popping them.
+void vm_truncate_values(Vm* vm, size_t count);
+
 #define VM_ROOT(vm, object) GC_ROOT(&(vm)->gc, (object))
 #define VM_UNROOT(vm, object) GC_UNROOT(&(vm)->gc, (object))
+#define VM_FRAME_BEGIN(vm, ...) GC_FRAME_BEGIN(&(vm)->gc, __VA_ARGS__)
+#define VM_FRAME_END(vm) GC_FRAME_END(&(vm)->gc)
+#define VM_WRITE_BARRIER(vm, object) GC_WRITE_BARRIER(&(vm)->gc, (object))
 
+/// Returns the interned symbol named `symbol`, allocating it if it doesn't
+/// exist yet.
 SExpr* vm_alloc_symbol(Vm* vm, s8 symbol);
-SExpr* vm_alloc_symbol_with_length(Vm* vm, size_t len);
+/// Returns the interned symbol named `symbol`, or `NIL` if it doesn't exist.
+///
+/// Unlike `vm_alloc_symbol`, this never allocates.
+SExpr* vm_find_symbol(Vm* vm, s8 symbol);
 SExpr* vm_alloc_string(Vm* vm, s8 string);
 SExpr* vm_alloc_string_with_length(Vm* vm, size_t len);
+/// Returns `number` as an immediate value if possible, and otherwise
+/// allocates it.
 SExpr* vm_alloc_number(Vm* vm, double number);
 SExpr* vm_alloc_cons(Vm* vm, SExpr* car, SExpr* cdr);
+SExpr* vm_alloc_local(Vm* vm, SExpr* symbol, size_t slot);
+/// Allocates a function named `id` that binds the already validated list of
+/// parameters `params` and evaluates `body`.
+SExpr* vm_alloc_closure(Vm* vm, SExpr* id, SExpr* params, SExpr* body);
+/// Allocates a vector of `len` items that each start out as `fill`.
+SExpr* vm_alloc_vector(Vm* vm, size_t len, SExpr* fill);
+/// Allocates code with room for `constant_count` constants, which start out
+/// as `NIL`, followed by `length` bytes of instructions.
+SExpr* vm_alloc_code(
+    Vm* vm,
+    SExpr* source,
+    SExpr* params,
+    size_t constant_count,
+    size_t length
+);
+
+/// The instructions of compiled code, which operate on a stack of values.
+///
+/// Operands are 16-bit little-endian values following the opcode. Jump
+/// targets are offsets from the start of the instructions.
+typedef enum {
+    // Pushes constant `index`.
+    OP_CONST,
+    // Pushes the value of parameter `slot` of the running function.
+    OP_LOCAL,
+    // Pushes the value of the variable named by constant `index`.
+    OP_LOOKUP,
+    // Pops a value and binds the variable named by constant `index` to it in
+    // the running function's frame, like `let`.
+    OP_LET,
+    // Pops a value and binds the global variable named by constant `index` to
+    // it, like `set`.
+    OP_SET,
+    OP_POP,
+    // Jumps to `target`.
+    OP_JUMP,
+    // Pops a value and jumps to `target` if it is `NIL`.
+    OP_JUMP_IF_NIL,
+    // Reports that no clause of the `cond` named by constant `index` matched.
+    OP_COND_FAIL,
+    // Pops `count` arguments and pushes the result of calling the builtin
+    // named by constant `index` with them.
+    OP_BUILTIN,
+    // Like `OP_BUILTIN` with two arguments, but computed without a call when
+    // both arguments are numbers.
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_LT,
+    OP_GT,
+    OP_LTE,
+    OP_GTE,
+    // Pushes `t` if the popped value is `NIL` and `NIL` otherwise.
+    OP_NOT,
+    // Pops two values and pushes their cons.
+    OP_CONS,
+    // Pushes a frame for the user function called by the form in constant
+    // `index`, checking that it takes `count` arguments, and pushes its
+    // closure. The arguments are
+    // then evaluated in that frame, like in `eval_func`.
+    //
+    // The closure is looked up once and kept in the code's cache `cache`
+    // until another function is defined.
+    OP_PREPARE,
+    // Pops `count` arguments and the closure below them, binds them to the
+    // prepared frame and pushes the result of the function's body.
+    OP_CALL,
+    // Like `OP_CALL`, but the function's body finishes the running code.
+    //
+    // When the callee's parameters shadow every binding of the caller, as in
+    // a loop that calls itself, its compiled body is run in place of the
+    // running code. Other bodies are left to `eval_internal`, which replaces
+    // the caller's frame with the callee's.
+    OP_TAIL_CALL,
+    // Pushes the result of evaluating the form in constant `index` with
+    // `eval_internal`, for forms that aren't compiled. A form followed by
+    // `OP_RETURN` is left to `eval_internal` instead.
+    OP_EVAL,
+    // Returns the value on top of the stack.
+    OP_RETURN,
+} OpCode;
+
+struct EvalContext;
+
+/// Runs the instructions of `code`.
+///
+/// A form that is left in tail position, which the caller must evaluate in
+/// place of the code to get its result, is stored in `tail`. It is `NULL`
+/// otherwise. If the current frame doesn't bind the parameters the code was
+/// compiled for, that is the source it was compiled from.
+bool vm_execute(
+    Vm* vm,
+    struct EvalContext* context,
+    SExpr* code,
+    SExpr** result,
+    SExpr** tail
+);
 
 void env_init(Vm* vm, Environment* env);
-void env_free(Environment* env);
 
 void env_set(Vm* vm, Environment* env, SExpr* symbol, SExpr* value);
 bool env_lookup(Environment* env, SExpr* symbol, SExpr** value);
 
+/// Binds `symbol` to `value`, replacing any existing binding.
+///
+/// `table` must point to a rooted reference, since the table is replaced when
+/// it grows.
+void env_table_set(Vm* vm, EnvTable** table, SExpr* symbol, SExpr* value);
+bool env_table_lookup(EnvTable* table, SExpr* symbol, SExpr** value);
+
 #ifdef ENABLE_TESTS
 
 #include "test.h"
@@ -1,8 +1,19 @@
+// Required for `MAP_ANONYMOUS` and `madvise`.
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
+#include <string.h>
 
 #include "common.h"
 #include "arena.h"
 
+#ifdef ENABLE_MMAP_ARENAS
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#endif
+
 #ifdef ENABLE_VALGRIND_SUPPORT
 
 #include <valgrind/valgrind.h>
@@ -10,38 +21,81 @@
 
 #endif
 
+#ifdef ENABLE_MMAP_ARENAS
+
+static size_t page_size(void) {
+    static size_t size = 0;
+    if (size == 0) size = (size_t) sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+static size_t round_to_page(size_t size) {
+    return (size + page_size() - 1) & ~(page_size() - 1);
+}
+
+static uint8_t* map_region(size_t size) {
+    // Pages are only backed by memory once they are touched.
+    void* ptr = mmap(
+        NULL,
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+        -1,
+        0
+    );
+    return ptr == MAP_FAILED ? NULL : (uint8_t*) ptr;
+}
+
+#endif
+
 bool arena_init(Arena* arena, size_t capacity) {
-    if (capacity == 0) {
+    return arena_init_reserved(arena, capacity, capacity);
+}
+
+bool arena_init_reserved(Arena* arena, size_t capacity, size_t reserve) {
+    if (reserve < capacity) reserve = capacity;
+
+    if (reserve == 0) {
         arena->base = NULL;
         arena->next = NULL;
         arena->end = NULL;
+        arena->limit = NULL;
         return true;
     }
 
+#ifdef ENABLE_MMAP_ARENAS
+    reserve = round_to_page(reserve);
+    arena->base = map_region(reserve);
+
+    // Fall back to reserving only what is needed right now.
+    if (arena->base == NULL && reserve > round_to_page(capacity)) {
+        reserve = round_to_page(capacity);
+        arena->base = map_region(reserve);
+    }
+#else
+    reserve = capacity;
     arena->base = malloc(capacity);
+#endif
     if (arena->base == NULL) {
         return false;
     }
 
     arena->next = arena->base;
     arena->end = arena->base + capacity;
+    arena->limit = arena->base + reserve;
 
 #ifdef ENABLE_VALGRIND_SUPPORT
     VALGRIND_CREATE_MEMPOOL(arena->base, 0, false);
 #endif
 
-#ifdef DEBUG_CLEAR_ARENA
+#if defined(DEBUG_CLEAR_ARENA) && !defined(ENABLE_MMAP_ARENAS)
+    // Mapped memory is already zeroed.
 
 #ifdef ENABLE_VALGRIND_SUPPORT
     VALGRIND_MAKE_MEM_UNDEFINED(arena->base, capacity);
 #endif
 
-    while (arena->next != arena->end) {
-        *arena->next = 0;
-        arena->next += 1;
-    }
-
-    arena->next = arena->base;
+    memset(arena->base, 0, capacity);
 #endif
 
 #ifdef ENABLE_VALGRIND_SUPPORT
@@ -54,17 +108,31 @@ void arena_free(Arena* arena) {
 #ifdef ENABLE_VALGRIND_SUPPORT
     VALGRIND_DESTROY_MEMPOOL(arena->base);
 #endif
+#ifdef ENABLE_MMAP_ARENAS
+    if (arena->base != NULL) munmap(arena->base, arena->limit - arena->base);
+#else
     free(arena->base);
+#endif
 
     arena->base = NULL;
     arena->next = NULL;
     arena->end = NULL;
+    arena->limit = NULL;
 }
 
 size_t arena_capacity(Arena* arena) {
     return arena->end - arena->base;
 }
 
+size_t arena_reserved(Arena* arena) {
+    return arena->limit - arena->base;
+}
+
+bool arena_contains(Arena* arena, const void* ptr) {
+    return arena->base <= (const uint8_t*) ptr
+        && (const uint8_t*) ptr < arena->end;
+}
+
 uint8_t* arena_alloc(Arena* arena, size_t size, size_t align, size_t count) {
     size_t padding = (-(uintptr_t) arena->next) & (align - 1);
     size_t remaining = arena->end - arena->next;
@@ -90,24 +158,67 @@ void arena_reset(Arena* arena) {
     VALGRIND_MEMPOOL_TRIM(arena->base, arena->base, 0);
 #endif
 
-    arena->next = arena->base;
-
 #ifdef DEBUG_CLEAR_ARENA
+    // Memory past `next` has not been handed out since it was last cleared.
 
 #ifdef ENABLE_VALGRIND_SUPPORT
-    VALGRIND_MAKE_MEM_UNDEFINED(arena->base, arena->end - arena->base);
+    VALGRIND_MAKE_MEM_UNDEFINED(arena->base, arena->next - arena->base);
 #endif
 
-    while (arena->next != arena->end) {
-        *arena->next = 0;
-        arena->next += 1;
-    }
+    memset(arena->base, 0, arena->next - arena->base);
 
 #ifdef ENABLE_VALGRIND_SUPPORT
     VALGRIND_MAKE_MEM_NOACCESS(arena->base, arena->end - arena->base);
+#endif
 #endif
 
     arena->next = arena->base;
+}
+
+bool arena_resize(Arena* arena, size_t capacity) {
+    if (capacity > arena_reserved(arena)) {
+        return false;
+    }
+
+    arena_reset(arena);
+
+#ifdef ENABLE_MMAP_ARENAS
+    // Drop the pages that are no longer part of the arena, so that they read
+    // as zero if the arena grows back into them.
+    uint8_t* release_start = arena->base + round_to_page(capacity);
+    if (release_start < arena->end) {
+        madvise(release_start, arena->end - release_start, MADV_DONTNEED);
+    }
+#endif
+
+    arena->end = arena->base + capacity;
+#ifdef ENABLE_VALGRIND_SUPPORT
+    VALGRIND_MAKE_MEM_NOACCESS(arena->base, capacity);
+#endif
+    return true;
+}
+
+void arena_release(Arena* arena) {
+    arena_reset(arena);
+
+#ifdef ENABLE_MMAP_ARENAS
+    if (arena->base == NULL) return;
+
+#ifdef MADV_FREE
+    // Lets the kernel reclaim the pages lazily, which is cheaper than
+    // unmapping them if they are reused soon.
+    madvise(arena->base, round_to_page(arena_capacity(arena)), MADV_FREE);
+#else
+    madvise(arena->base, round_to_page(arena_capacity(arena)), MADV_DONTNEED);
+#endif
+#endif
+}
+
+void arena_advise_huge_pages(Arena* arena) {
+#if defined(ENABLE_MMAP_ARENAS) && defined(MADV_HUGEPAGE)
+    if (arena->base == NULL) return;
+
+    madvise(arena->base, arena_reserved(arena), MADV_HUGEPAGE);
 #endif
 }
 
@@ -158,9 +269,33 @@ cleanup:
     return result;
 }
 
+static bool arena_resize_in_place() {
+    Arena arena;
+    if (!arena_init_reserved(&arena, 1024, 64 * 1024)) return false;
+
+    bool result = false;
+    uint8_t* base = arena.base;
+
+    if (!arena_resize(&arena, 32 * 1024)) goto cleanup;
+    if (arena.base != base || arena_capacity(&arena) != 32 * 1024) goto cleanup;
+    if (arena_alloc(&arena, 1, 1, 32 * 1024) == NULL) goto cleanup;
+
+    arena_release(&arena);
+    if (arena_alloc(&arena, 1, 1, 32 * 1024) != base) goto cleanup;
+
+    if (!arena_resize(&arena, 512)) goto cleanup;
+    if (arena_alloc(&arena, 1, 1, 1024) != NULL) goto cleanup;
+
+    result = !arena_resize(&arena, 128 * 1024);
+cleanup:
+    arena_free(&arena);
+    return result;
+}
+
 static TestDefinition arena_tests[] = {
     DEFINE_UNIT_TEST(arena_alloc_from_unaligned, 0),
     DEFINE_UNIT_TEST(arena_alloc_can_fill, 0),
+    DEFINE_UNIT_TEST(arena_resize_in_place, 0),
 };
 
 TestList arena_test_list = (TestList) {
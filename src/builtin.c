@@ -1,37 +1,51 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "builtin.h"
 #include "common.h"
+#include "compiler.h"
 #include "eval-context.h"
 #include "eval-impl.h"
 #include "parser.h"
+#include "resolve.h"
 #include "sexpr.h"
 #include "util.h"
 #include "vm.h"
 
 #define DEFINE_BUILTIN(name, arg_count, func) \
-    (BuiltinDef) { s8(name), false, arg_count, true, func }
+    (BuiltinDef) { s8(name), false, arg_count, true, true, false, func, NULL }
 
-#define DEFINE_BUILTIN_VARIADIC(name, func) \
-    (BuiltinDef) { s8(name), true, 0, true, func }
+#define DEFINE_BUILTIN_VARIADIC(name, min_arg_count, func) \
+    (BuiltinDef) { \
+        s8(name), true, min_arg_count, true, true, false, func, NULL \
+    }
+
+#define DEFINE_BUILTIN_NON_LEAF(name, arg_count, func) \
+    (BuiltinDef) { s8(name), false, arg_count, true, false, false, func, NULL }
 
 #define DEFINE_BUILTIN_NO_EVAL(name, arg_count, func) \
-    (BuiltinDef) { s8(name), false, arg_count, false, func }
+    (BuiltinDef) { s8(name), false, arg_count, false, false, false, NULL, func }
 
 #define DEFINE_BUILTIN_NO_EVAL_VARIADIC(name, func) \
-    (BuiltinDef) { s8(name), true, 0, false, func }
+    (BuiltinDef) { s8(name), true, 0, false, false, false, NULL, func }
+
+#define DEFINE_BUILTIN_TAIL(name, arg_count, func) \
+    (BuiltinDef) { s8(name), false, arg_count, false, false, true, NULL, func }
+
+#define DEFINE_BUILTIN_TAIL_VARIADIC(name, func) \
+    (BuiltinDef) { s8(name), true, 0, false, false, true, NULL, func }
 
 static bool builtin_is_nil(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = IS_NIL(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_NIL(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -39,11 +53,11 @@ static bool builtin_is_symbol(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = IS_SYMBOL(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_SYMBOL(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -51,11 +65,11 @@ static bool builtin_is_string(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = IS_STRING(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_STRING(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -63,11 +77,11 @@ static bool builtin_is_number(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = IS_NUMBER(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_NUMBER(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -75,35 +89,50 @@ static bool builtin_is_list(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = IS_CONS(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_CONS(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
-static bool builtin_sexp_to_bool(
+static bool builtin_is_vector(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    *result = !IS_NIL(arg_0) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    SExpr* arg_0 = args[0];
+    *result = IS_VECTOR(arg_0) ? vm->t_symbol : NIL;
     return true;
 }
 
-static bool two_numbers(EvalContext* context, SExpr* args) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-
-    if (!IS_NUMBER(arg_0))
-        eval_context_invalid_type(context, 0, arg_0, SEXPR_NUMBER);
+static bool builtin_sexp_to_bool(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    SExpr* arg_0 = args[0];
+    *result = !IS_NIL(arg_0) ? vm->t_symbol : NIL;
+    return true;
+}
 
-    if (!IS_NUMBER(arg_1))
-        eval_context_invalid_type(context, 1, arg_1, SEXPR_NUMBER);
+// Reports every argument that isn't a number, returning `true` if there are
+// none.
+static bool all_numbers(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args
+) {
+    for (size_t i = 0; i < arg_count; i++) {
+        if (!IS_NUMBER(args[i]))
+            eval_context_invalid_type(vm, context, i, args[i], SEXPR_NUMBER);
+    }
 
     return eval_context_is_ok(context);
 }
@@ -112,17 +141,17 @@ static bool builtin_add(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    *result = vm_alloc_number(
-        vm,
-        EXTRACT_NUMBER(arg_0) + EXTRACT_NUMBER(arg_1)
-    );
+    double sum = 0;
+    for (size_t i = 0; i < arg_count; i++) {
+        sum += EXTRACT_NUMBER(args[i]);
+    }
+
+    *result = vm_alloc_number(vm, sum);
     return true;
 }
 
@@ -130,17 +159,20 @@ static bool builtin_sub(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    *result = vm_alloc_number(
-        vm,
-        EXTRACT_NUMBER(arg_0) - EXTRACT_NUMBER(arg_1)
-    );
+    double difference = EXTRACT_NUMBER(args[0]);
+    for (size_t i = 1; i < arg_count; i++) {
+        difference -= EXTRACT_NUMBER(args[i]);
+    }
+
+    // A single argument is negated.
+    if (arg_count == 1) difference = -difference;
+
+    *result = vm_alloc_number(vm, difference);
     return true;
 }
 
@@ -148,17 +180,17 @@ static bool builtin_mul(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    *result = vm_alloc_number(
-        vm,
-        EXTRACT_NUMBER(arg_0) * EXTRACT_NUMBER(arg_1)
-    );
+    double product = 1;
+    for (size_t i = 0; i < arg_count; i++) {
+        product *= EXTRACT_NUMBER(args[i]);
+    }
+
+    *result = vm_alloc_number(vm, product);
     return true;
 }
 
@@ -166,17 +198,20 @@ static bool builtin_div(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    *result = vm_alloc_number(
-        vm,
-        EXTRACT_NUMBER(arg_0) / EXTRACT_NUMBER(arg_1)
-    );
+    double quotient = EXTRACT_NUMBER(args[0]);
+    for (size_t i = 1; i < arg_count; i++) {
+        quotient /= EXTRACT_NUMBER(args[i]);
+    }
+
+    // A single argument is inverted.
+    if (arg_count == 1) quotient = 1 / quotient;
+
+    *result = vm_alloc_number(vm, quotient);
     return true;
 }
 
@@ -184,13 +219,13 @@ static bool builtin_mod(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
+    SExpr* arg_0 = args[0];
+    SExpr* arg_1 = args[1];
 
     double dividend = EXTRACT_NUMBER(arg_0) / EXTRACT_NUMBER(arg_1);
     if (!isnormal(dividend)) {
@@ -208,18 +243,20 @@ static bool builtin_lt(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
-
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    if (EXTRACT_NUMBER(arg_0) < EXTRACT_NUMBER(arg_1)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
-    } else {
-        *result = NIL;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
+
+    // Each argument is compared with the next.
+    *result = vm->t_symbol;
+    for (size_t i = 1; i < arg_count; i++) {
+        if (!(EXTRACT_NUMBER(args[i - 1]) < EXTRACT_NUMBER(args[i]))) {
+            *result = NIL;
+            break;
+        }
     }
+
     return true;
 }
 
@@ -227,18 +264,19 @@ static bool builtin_gt(
 	Vm* vm,
 	EvalContext* context,
 	size_t arg_count,
-	SExpr* args,
+	SExpr** args,
 	SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    if (EXTRACT_NUMBER(arg_0) > EXTRACT_NUMBER(arg_1)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
-    } else {
-        *result = NIL;
+    *result = vm->t_symbol;
+    for (size_t i = 1; i < arg_count; i++) {
+        if (!(EXTRACT_NUMBER(args[i - 1]) > EXTRACT_NUMBER(args[i]))) {
+            *result = NIL;
+            break;
+        }
     }
+
     return true;
 }
 
@@ -246,18 +284,19 @@ static bool builtin_lte(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    if (EXTRACT_NUMBER(arg_0) <= EXTRACT_NUMBER(arg_1)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
-    } else {
-        *result = NIL;
+    *result = vm->t_symbol;
+    for (size_t i = 1; i < arg_count; i++) {
+        if (!(EXTRACT_NUMBER(args[i - 1]) <= EXTRACT_NUMBER(args[i]))) {
+            *result = NIL;
+            break;
+        }
     }
+
     return true;
 }
 
@@ -265,18 +304,19 @@ static bool builtin_gte(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    if (!two_numbers(context, args)) return false;
+    if (!all_numbers(vm, context, arg_count, args)) return false;
 
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
-    if (EXTRACT_NUMBER(arg_0) >= EXTRACT_NUMBER(arg_1)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
-    } else {
-        *result = NIL;
+    *result = vm->t_symbol;
+    for (size_t i = 1; i < arg_count; i++) {
+        if (!(EXTRACT_NUMBER(args[i - 1]) >= EXTRACT_NUMBER(args[i]))) {
+            *result = NIL;
+            break;
+        }
     }
+
     return true;
 }
 
@@ -284,15 +324,15 @@ static bool builtin_eq(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg_0 = EXTRACT_CAR(args);
-    SExpr* arg_1 = EXTRACT_CAR(EXTRACT_CDR(args));
+    SExpr* arg_0 = args[0];
+    SExpr* arg_1 = args[1];
 
     bool eq = false;
     if (IS_SYMBOL(arg_0) && IS_SYMBOL(arg_1)) {
-        eq = s8_equals(EXTRACT_SYMBOL(arg_0), EXTRACT_SYMBOL(arg_1));
+        eq = arg_0 == arg_1;
     } else if (IS_STRING(arg_0) && IS_STRING(arg_1)) {
         eq = s8_equals(EXTRACT_STRING(arg_0), EXTRACT_STRING(arg_1));
     } else if (IS_NUMBER(arg_0) && IS_NUMBER(arg_1)) {
@@ -301,15 +341,29 @@ static bool builtin_eq(
 
         double precision = val_0 * val_1 * 0.000001;
         eq = fabs(val_0 - val_1) < precision;
-    } else if (IS_CONS(arg_0) || IS_CONS(arg_1)) {
-        eval_context_illegal_call(context, args);
+    } else if (
+        IS_CONS(arg_0)
+        || IS_CONS(arg_1)
+        || IS_CLOSURE(arg_0)
+        || IS_CLOSURE(arg_1)
+        || IS_VECTOR(arg_0)
+        || IS_VECTOR(arg_1)
+    ) {
+        // The error reports the arguments as a list, which is only built
+        // here since the values are rooted by the caller.
+        SExpr* list = NIL;
+        VM_FRAME_BEGIN(vm, &context, &list);
+        list = vm_alloc_cons(vm, args[1], NIL);
+        list = vm_alloc_cons(vm, args[0], list);
+        eval_context_illegal_call(vm, context, list);
+        VM_FRAME_END(vm);
         return false;
     } else {
-        eval_context_invalid_type(context, 1, arg_1, EXTRACT_TYPE(arg_0));
+        eval_context_invalid_type(vm, context, 1, arg_1, EXTRACT_TYPE(arg_0));
         return false;
     }
 
-    *result = eq ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    *result = eq ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -317,13 +371,13 @@ static bool builtin_neq(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
     bool success = builtin_eq(vm, context, arg_count, args, result);
     if (!success) return false;
 
-    *result = IS_NIL(*result) ? vm_alloc_symbol(vm, s8("t")) : NIL;
+    *result = IS_NIL(*result) ? vm->t_symbol : NIL;
     return true;
 }
 
@@ -331,7 +385,7 @@ static bool builtin_not(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
     return builtin_is_nil(vm, context, arg_count, args, result);
@@ -341,21 +395,12 @@ static bool builtin_car(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg = EXTRACT_CAR(args);
+    SExpr* arg = args[0];
     if (!IS_CONS(arg)) {
-        eval_context_invalid_type(context, 0, arg, SEXPR_CONS);
-        return false;
-    }
-
-    bool is_function =
-        !IS_NIL(arg)
-        && IS_SYMBOL(EXTRACT_CAR(arg))
-        && s8_equals(EXTRACT_SYMBOL(EXTRACT_CAR(arg)), s8("'function"));
-    if (is_function) {
-        eval_context_invalid_type(context, 0, arg, SEXPR_CONS);
+        eval_context_invalid_type(vm, context, 0, arg, SEXPR_CONS);
         return false;
     }
 
@@ -367,37 +412,176 @@ static bool builtin_cdr(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    SExpr* arg = EXTRACT_CAR(args);
+    SExpr* arg = args[0];
     if (!IS_CONS(arg)) {
-        eval_context_invalid_type(context, 0, arg, SEXPR_CONS);
+        eval_context_invalid_type(vm, context, 0, arg, SEXPR_CONS);
         return false;
     }
 
-    bool is_function =
-        !IS_NIL(arg)
-        && IS_SYMBOL(EXTRACT_CAR(arg))
-        && s8_equals(EXTRACT_SYMBOL(EXTRACT_CAR(arg)), s8("'function"));
-    if (is_function) {
-        eval_context_invalid_type(context, 0, arg, SEXPR_CONS);
+    *result = IS_NIL(arg) ? NIL : EXTRACT_CDR(arg);
+    return true;
+}
+
+static bool builtin_cons(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    *result = vm_alloc_cons(vm, args[0], args[1]);
+    return true;
+}
+
+// Longer vectors couldn't be addressed, so they are rejected before their size
+// can overflow.
+#define VECTOR_MAX_LEN (SIZE_MAX / 2 / sizeof(SExpr*))
+
+// Converts argument `arg_index` to an index below `bound`, reporting an error
+// if it isn't a whole number in that range.
+static bool to_index(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_index,
+    SExpr* arg,
+    size_t bound,
+    size_t* index
+) {
+    if (!IS_NUMBER(arg)) {
+        eval_context_invalid_type(vm, context, arg_index, arg, SEXPR_NUMBER);
         return false;
     }
 
-    *result = IS_NIL(arg) ? NIL : EXTRACT_CDR(arg);
+    double number = EXTRACT_NUMBER(arg);
+    if (!(number >= 0 && number < (double) bound && number == floor(number))) {
+        eval_context_index_out_of_range(vm, context, arg_index, arg);
+        return false;
+    }
+
+    *index = (size_t) number;
     return true;
 }
 
-static bool builtin_cons(
+static bool builtin_make_vector(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
+    SExpr** result
+) {
+    // The items are `NIL` unless a value to fill them with is given.
+    if (arg_count > 2) {
+        eval_context_erronous_arg_count(context, 2);
+        return false;
+    }
+
+    size_t len;
+    if (!to_index(vm, context, 0, args[0], VECTOR_MAX_LEN, &len)) {
+        return false;
+    }
+
+    *result = vm_alloc_vector(vm, len, arg_count == 2 ? args[1] : NIL);
+    return true;
+}
+
+static bool builtin_vector_ref(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
     SExpr** result
 ) {
-    *result =
-        vm_alloc_cons(vm, EXTRACT_CAR(args), EXTRACT_CAR(EXTRACT_CDR(args)));
+    SExpr* vector = args[0];
+    if (!IS_VECTOR(vector)) {
+        eval_context_invalid_type(vm, context, 0, vector, SEXPR_VECTOR);
+        return false;
+    }
+
+    size_t index;
+    size_t len = AS_VECTOR(vector)->len;
+    if (!to_index(vm, context, 1, args[1], len, &index)) return false;
+
+    *result = AS_VECTOR(vector)->items[index];
+    return true;
+}
+
+static bool builtin_vector_set(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    SExpr* vector = args[0];
+    if (!IS_VECTOR(vector)) {
+        eval_context_invalid_type(vm, context, 0, vector, SEXPR_VECTOR);
+        return false;
+    }
+
+    size_t index;
+    size_t len = AS_VECTOR(vector)->len;
+    if (!to_index(vm, context, 1, args[1], len, &index)) return false;
+
+    AS_VECTOR(vector)->items[index] = args[2];
+    VM_WRITE_BARRIER(vm, vector);
+
+    *result = args[2];
+    return true;
+}
+
+static bool builtin_vector_length(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    SExpr* vector = args[0];
+    if (!IS_VECTOR(vector)) {
+        eval_context_invalid_type(vm, context, 0, vector, SEXPR_VECTOR);
+        return false;
+    }
+
+    *result = vm_alloc_number(vm, (double) AS_VECTOR(vector)->len);
+    return true;
+}
+
+static bool builtin_list_to_vector(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    size_t len = 0;
+    SExpr* item = args[0];
+    while (!IS_NIL(item)) {
+        if (!IS_CONS(item) && len == 0) {
+            eval_context_invalid_type(vm, context, 0, item, SEXPR_CONS);
+            return false;
+        } else if (!IS_CONS(item)) {
+            eval_context_dotted_arg_list(vm, context, len, args[0]);
+            return false;
+        }
+
+        len += 1;
+        item = EXTRACT_CDR(item);
+    }
+
+    // The list is rooted by the caller and is only walked again once the
+    // vector has been allocated.
+    SExpr* vector = vm_alloc_vector(vm, len, NIL);
+
+    item = args[0];
+    for (size_t i = 0; i < len; i++) {
+        AS_VECTOR(vector)->items[i] = EXTRACT_CAR(item);
+        item = EXTRACT_CDR(item);
+    }
+
+    *result = vector;
     return true;
 }
 
@@ -405,21 +589,21 @@ static bool builtin_eval(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    return eval_internal(vm, context, EXTRACT_CAR(args), result);
+    return eval_internal(vm, context, args[0], result);
 }
 
 static bool builtin_print(
     Vm* vm,
     EvalContext* context,
     size_t arg_count,
-    SExpr* args,
+    SExpr** args,
     SExpr** result
 ) {
-    PRINT_SEXPR(EXTRACT_CAR(args)); printf("\n");
-    *result = EXTRACT_CAR(args);
+    PRINT_SEXPR(args[0]); printf("\n");
+    *result = args[0];
     return true;
 }
 
@@ -443,6 +627,7 @@ static bool builtin_and(
     }
     if (IS_NIL(eval_result)) {
         *result = NIL;
+        success = true;
         goto cleanup;
     }
 
@@ -470,7 +655,7 @@ static bool builtin_or(
 
     SExpr* eval_result = NULL;
     if (!eval_internal(vm, context, arg_0, &eval_result)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
+        *result = vm->t_symbol;
         VM_UNROOT(vm, &arg_1);
         VM_UNROOT(vm, &context);
         return true;
@@ -479,7 +664,7 @@ static bool builtin_or(
     VM_UNROOT(vm, &arg_1);
     VM_UNROOT(vm, &context);
     if (!IS_NIL(eval_result)) {
-        *result = vm_alloc_symbol(vm, s8("t"));
+        *result = vm->t_symbol;
         return true;
     }
 
@@ -508,14 +693,10 @@ static bool builtin_if(
     VM_UNROOT(vm, &context);
 
     if (!success) return false;
-    if (!IS_NIL(eval_result)) {
-        success = eval_internal(vm, context, arg_1, &eval_result);
-    } else {
-        success = eval_internal(vm, context, arg_2, &eval_result);
-    }
 
-    if (success) *result = eval_result;
-    return success;
+    // The chosen branch is evaluated by the caller.
+    *result = !IS_NIL(eval_result) ? arg_1 : arg_2;
+    return true;
 }
 
 static bool builtin_function(
@@ -526,25 +707,23 @@ static bool builtin_function(
     SExpr** result
 ) {
     if (!IS_SYMBOL(EXTRACT_CAR(args))) {
-        eval_context_invalid_type(context, 0, EXTRACT_CAR(args), SEXPR_SYMBOL);
+        eval_context_invalid_type(
+            vm,
+            context,
+            0,
+            EXTRACT_CAR(args),
+            SEXPR_SYMBOL
+        );
         return false;
     }
 
-    if (!env_lookup(&vm->funcs, EXTRACT_CAR(args), result)) {
-        if (lookup_builtin(EXTRACT_SYMBOL(EXTRACT_CAR(args)), NULL)) {
-            SExpr* struc = vm_alloc_cons(
-                vm, 
-                EXTRACT_CAR(args),
-                vm_alloc_cons(vm, NIL, vm_alloc_cons(vm, NIL, NIL))
-            );
-            VM_ROOT(vm, &struc);
-            *result =
-                vm_alloc_cons(vm, vm_alloc_symbol(vm, s8("'function")), struc);
-            VM_UNROOT(vm, &struc);
+    if (!env_table_lookup(vm->funcs, EXTRACT_CAR(args), result)) {
+        if (lookup_builtin(EXTRACT_CAR(args)) != NULL) {
+            *result = vm_alloc_closure(vm, EXTRACT_CAR(args), NIL, NIL);
             return true;
         }
 
-        eval_context_symbol_lookup_failed(context, EXTRACT_CAR(args));
+        eval_context_symbol_lookup_failed(vm, context, EXTRACT_CAR(args));
         return false;
     }
     return true;
@@ -557,23 +736,24 @@ static bool builtin_lambda(
     SExpr* args,
     SExpr** result
 ) {
-    if (!validate_function_def(context, args)) {
+    if (!validate_function_def(vm, context, args)) {
         return false;
     }
 
     VM_ROOT(vm, &args);
 
-    SExpr* lambda_symbol = vm_alloc_symbol(vm, s8("lambda"));
-    SExpr* id = vm_alloc_cons(vm, lambda_symbol, args);
-    SExpr* tmp = vm_alloc_cons(vm, id, args);
+    SExpr* id = vm_alloc_cons(vm, vm->lambda_symbol, args);
+    VM_ROOT(vm, &id);
 
-    VM_UNROOT(vm, &args);
-
-    VM_ROOT(vm, &tmp);
-    SExpr* function_symbol = vm_alloc_symbol(vm, s8("'function"));
-    VM_UNROOT(vm, &tmp);
+    SExpr* body = resolve_locals(
+        vm,
+        EXTRACT_CAR(args),
+        EXTRACT_CAR(EXTRACT_CDR(args))
+    );
+    *result = vm_alloc_closure(vm, id, EXTRACT_CAR(args), body);
 
-    *result = vm_alloc_cons(vm, function_symbol, tmp);
+    VM_UNROOT(vm, &id);
+    VM_UNROOT(vm, &args);
     return true;
 }
 
@@ -589,7 +769,7 @@ static bool builtin_let(
     SExpr* var_name = EXTRACT_CAR(args);
     SExpr* value = EXTRACT_CAR(EXTRACT_CDR(args));
     if (!IS_SYMBOL(var_name)) {
-        eval_context_invalid_type(context, 0, var_name, SEXPR_SYMBOL);
+        eval_context_invalid_type(vm, context, 0, var_name, SEXPR_SYMBOL);
         return false;
     }
 
@@ -634,7 +814,7 @@ static bool builtin_set(
     SExpr* var_name = EXTRACT_CAR(args);
     SExpr* value = EXTRACT_CAR(EXTRACT_CDR(args));
     if (!IS_SYMBOL(var_name)) {
-        eval_context_invalid_type(context, 0, var_name, SEXPR_SYMBOL);
+        eval_context_invalid_type(vm, context, 0, var_name, SEXPR_SYMBOL);
         return false;
     }
 
@@ -647,7 +827,7 @@ static bool builtin_set(
         goto cleanup;
     }
 
-    env_set(vm, &vm->vars, var_name, eval_result);
+    env_table_set(vm, &vm->vars, var_name, eval_result);
     success = true;
 
 cleanup:
@@ -675,7 +855,7 @@ static bool builtin_begin(
 
     VM_ROOT(vm, &context);
     VM_ROOT(vm, &arg_cons);
-    while (!IS_NIL(arg_cons)) {
+    while (!IS_NIL(EXTRACT_CDR(arg_cons))) {
         success = eval_internal(vm, context, EXTRACT_CAR(arg_cons), result);
         if (!success) {
             goto cleanup;
@@ -684,6 +864,10 @@ static bool builtin_begin(
         arg_cons = EXTRACT_CDR(arg_cons);
     }
 
+    // The last form is evaluated by the caller.
+    *result = EXTRACT_CAR(arg_cons);
+    success = true;
+
 cleanup:
     VM_UNROOT(vm, &arg_cons);
     VM_UNROOT(vm, &context);
@@ -706,11 +890,11 @@ static bool builtin_cond(
     while (!IS_NIL(args)) {
         SExpr* pair = EXTRACT_CAR(args);
         if (IS_NIL(pair) || !IS_CONS(pair)) {
-            eval_context_cond_arg_not_pair(context, arg_index, pair);
+            eval_context_cond_arg_not_pair(vm, context, arg_index, pair);
             goto cleanup;
         }
         if (IS_NIL(EXTRACT_CDR(pair)) || !IS_CONS(EXTRACT_CDR(pair))) {
-            eval_context_cond_arg_not_pair(context, arg_index, pair);
+            eval_context_cond_arg_not_pair(vm, context, arg_index, pair);
             goto cleanup;
         }
         SExpr* arg_0 = EXTRACT_CAR(pair);
@@ -720,13 +904,9 @@ static bool builtin_cond(
         }
 
         if (!IS_NIL(eval_result)) {
-            success = eval_internal(
-                vm,
-                context,
-                EXTRACT_CAR(EXTRACT_CDR(EXTRACT_CAR(args))),
-                &eval_result
-            );
-            if (success) *result = eval_result;
+            // The clause's form is evaluated by the caller.
+            *result = EXTRACT_CAR(EXTRACT_CDR(EXTRACT_CAR(args)));
+            success = true;
             goto cleanup;
         }
 
@@ -734,7 +914,7 @@ static bool builtin_cond(
         args = EXTRACT_CDR(args);
     }
 
-    eval_context_illegal_call(context, args);
+    eval_context_illegal_call(vm, context, args);
 cleanup:
     VM_UNROOT(vm, &args);
     VM_UNROOT(vm, &context);
@@ -754,32 +934,44 @@ static bool builtin_define(
     }
 
     if (!IS_SYMBOL(EXTRACT_CAR(args))) {
-        eval_context_invalid_type(context, 0, EXTRACT_CAR(args), SEXPR_SYMBOL);
+        eval_context_invalid_type(
+            vm,
+            context,
+            0,
+            EXTRACT_CAR(args),
+            SEXPR_SYMBOL
+        );
         return false;
     }
 
     VM_ROOT(vm, &args);
-    SExpr* body_begin = vm_alloc_symbol(vm, s8("begin"));
     SExpr* body =
-        vm_alloc_cons(vm, body_begin, EXTRACT_CDR(EXTRACT_CDR(args)));
+        vm_alloc_cons(vm, vm->begin_symbol, EXTRACT_CDR(EXTRACT_CDR(args)));
     SExpr* function_def = vm_alloc_cons(vm, body, NIL);
     function_def =
         vm_alloc_cons(vm, EXTRACT_CAR(EXTRACT_CDR(args)), function_def);
 
-    if (!validate_function_def(context, function_def)) {
+    if (!validate_function_def(vm, context, function_def)) {
+        VM_UNROOT(vm, &args);
         return false;
     }
 
-    function_def =
-        vm_alloc_cons(vm, EXTRACT_CAR(args), function_def);
-
-    VM_ROOT(vm, &function_def);
-    SExpr* function_data_start = vm_alloc_symbol(vm, s8("'function"));
-    VM_UNROOT(vm, &function_def);
-    function_def = vm_alloc_cons(vm, function_data_start, function_def);
+    body = resolve_locals(
+        vm,
+        EXTRACT_CAR(function_def),
+        EXTRACT_CAR(EXTRACT_CDR(function_def))
+    );
+    body = compile_function(vm, EXTRACT_CAR(EXTRACT_CDR(args)), body);
+    SExpr* closure = vm_alloc_closure(
+        vm,
+        EXTRACT_CAR(args),
+        EXTRACT_CAR(EXTRACT_CDR(args)),
+        body
+    );
     VM_UNROOT(vm, &args);
 
-    env_set(vm, &vm->funcs, EXTRACT_CAR(args), function_def);
+    env_table_set(vm, &vm->funcs, EXTRACT_CAR(args), closure);
+    vm->funcs_epoch += 1;
     return true;
 }
 
@@ -799,35 +991,27 @@ static bool builtin_funcall(
         goto cleanup;
     }
 
-    if (!IS_SYMBOL(EXTRACT_CAR(args))) {
-        eval_context_invalid_type(context, 0, EXTRACT_CAR(args), SEXPR_SYMBOL);
+    SExpr* name = EXTRACT_CAR(args);
+    if (!IS_SYMBOL(name) && !IS_LOCAL(name)) {
+        eval_context_invalid_type(vm, context, 0, name, SEXPR_SYMBOL);
         goto cleanup;
     }
 
+    // Evaluating the name looks it up, including as a resolved parameter.
     SExpr* func = NULL;
-    if (!eval_context_lookup(vm, context, EXTRACT_CAR(args), &func)) {
-        eval_context_symbol_lookup_failed(context, EXTRACT_CAR(args));
+    if (!eval_internal(vm, context, name, &func)) {
         goto cleanup;
     }
 
-    bool is_function_struct =
-        !IS_NIL(func)
-        && IS_CONS(func)
-        && IS_SYMBOL(EXTRACT_CAR(func))
-        && s8_equals(EXTRACT_SYMBOL(EXTRACT_CAR(func)), s8("'function"));
-    if (!is_function_struct) {
-        eval_context_illegal_call(context, args);
+    if (!IS_CLOSURE(func)) {
+        eval_context_illegal_call(vm, context, args);
         goto cleanup;
     }
 
-    success = eval_func(
-        vm,
-        context,
-        EXTRACT_CAR(EXTRACT_CDR(func)),
-        EXTRACT_CDR(EXTRACT_CDR(func)),
-        EXTRACT_CDR(args),
-        result
-    );
+    // The call is evaluated by the caller, with the closure in place of the
+    // function's name.
+    *result = vm_alloc_cons(vm, func, EXTRACT_CDR(args));
+    success = true;
 
 cleanup:
     VM_UNROOT(vm, &args);
@@ -835,36 +1019,121 @@ cleanup:
     return success;
 }
 
+// Prepends `(name values...)` to `*list`, which must be rooted.
+static void push_stat(
+    Vm* vm,
+    SExpr** list,
+    s8 name,
+    const size_t* values,
+    size_t count
+) {
+    SExpr* entry = NIL;
+    SExpr* number = NULL;
+    VM_FRAME_BEGIN(vm, &entry, &number);
+
+    for (size_t i = count; i > 0; i--) {
+        number = vm_alloc_number(vm, (double) values[i - 1]);
+        entry = vm_alloc_cons(vm, number, entry);
+    }
+
+    SExpr* symbol = vm_alloc_symbol(vm, name);
+    entry = vm_alloc_cons(vm, symbol, entry);
+    *list = vm_alloc_cons(vm, entry, *list);
+
+    VM_FRAME_END(vm);
+}
+
+static bool builtin_gc_stats(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_count,
+    SExpr** args,
+    SExpr** result
+) {
+    // Copy the statistics, since building the result changes them. The copy
+    // lives on the stack, so running out of memory below leaks nothing.
+    GcStats stats = vm->gc.stats;
+    size_t type_count = vm->gc.type_count;
+
+    size_t total_pause_us = stats.total_pause_ns / 1000;
+    size_t max_pause_us = stats.max_pause_ns / 1000;
+
+    SExpr* list = NIL;
+    VM_FRAME_BEGIN(vm, &list);
+
+    push_stat(
+        vm,
+        &list,
+        s8("pause-histogram"),
+        stats.pause_histogram,
+        countof(stats.pause_histogram)
+    );
+    push_stat(vm, &list, s8("max-pause-us"), &max_pause_us, 1);
+    push_stat(vm, &list, s8("total-pause-us"), &total_pause_us, 1);
+    push_stat(vm, &list, s8("survivors"), stats.survivors, type_count);
+    push_stat(
+        vm,
+        &list,
+        s8("large-object-size"),
+        &stats.large_object_size,
+        1
+    );
+    push_stat(vm, &list, s8("peak-heap-size"), &stats.peak_heap_size, 1);
+    push_stat(vm, &list, s8("heap-size"), &stats.heap_size, 1);
+    push_stat(vm, &list, s8("bytes-copied"), &stats.bytes_copied, 1);
+    push_stat(vm, &list, s8("bytes-allocated"), &stats.bytes_allocated, 1);
+    push_stat(
+        vm,
+        &list,
+        s8("major-collections"),
+        &stats.major_collections,
+        1
+    );
+    push_stat(
+        vm,
+        &list,
+        s8("minor-collections"),
+        &stats.minor_collections,
+        1
+    );
+
+    VM_FRAME_END(vm);
+
+    *result = list;
+    return true;
+}
+
 BuiltinDef builtin_def_list[] = {
     DEFINE_BUILTIN("nil?", 1, builtin_is_nil),
     DEFINE_BUILTIN("symbol?", 1, builtin_is_symbol),
     DEFINE_BUILTIN("string?", 1, builtin_is_string),
     DEFINE_BUILTIN("number?", 1, builtin_is_number),
     DEFINE_BUILTIN("list?", 1, builtin_is_list),
+    DEFINE_BUILTIN("vector?", 1, builtin_is_vector),
     DEFINE_BUILTIN("sexp_to_bool", 1, builtin_sexp_to_bool),
 
-    DEFINE_BUILTIN("add", 2, builtin_add),
-    DEFINE_BUILTIN("sub", 2, builtin_sub),
-    DEFINE_BUILTIN("mul", 2, builtin_mul),
-    DEFINE_BUILTIN("div", 2, builtin_div),
+    DEFINE_BUILTIN_VARIADIC("add", 0, builtin_add),
+    DEFINE_BUILTIN_VARIADIC("sub", 1, builtin_sub),
+    DEFINE_BUILTIN_VARIADIC("mul", 0, builtin_mul),
+    DEFINE_BUILTIN_VARIADIC("div", 1, builtin_div),
     DEFINE_BUILTIN("mod", 2, builtin_mod),
-    DEFINE_BUILTIN("+", 2, builtin_add),
-    DEFINE_BUILTIN("-", 2, builtin_sub),
-    DEFINE_BUILTIN("*", 2, builtin_mul),
-    DEFINE_BUILTIN("/", 2, builtin_div),
+    DEFINE_BUILTIN_VARIADIC("+", 0, builtin_add),
+    DEFINE_BUILTIN_VARIADIC("-", 1, builtin_sub),
+    DEFINE_BUILTIN_VARIADIC("*", 0, builtin_mul),
+    DEFINE_BUILTIN_VARIADIC("/", 1, builtin_div),
     DEFINE_BUILTIN("%", 2, builtin_mod),
 
-    DEFINE_BUILTIN("lt", 2, builtin_lt),
-    DEFINE_BUILTIN("gt", 2, builtin_gt),
-    DEFINE_BUILTIN("lte", 2, builtin_lte),
-    DEFINE_BUILTIN("gte", 2, builtin_gte),
+    DEFINE_BUILTIN_VARIADIC("lt", 2, builtin_lt),
+    DEFINE_BUILTIN_VARIADIC("gt", 2, builtin_gt),
+    DEFINE_BUILTIN_VARIADIC("lte", 2, builtin_lte),
+    DEFINE_BUILTIN_VARIADIC("gte", 2, builtin_gte),
     DEFINE_BUILTIN("eq", 2, builtin_eq),
     DEFINE_BUILTIN("neq", 2, builtin_neq),
     DEFINE_BUILTIN("not", 1, builtin_not),
-    DEFINE_BUILTIN("<", 2, builtin_lt),
-    DEFINE_BUILTIN(">", 2, builtin_gt),
-    DEFINE_BUILTIN("<=", 2, builtin_lte),
-    DEFINE_BUILTIN(">=", 2, builtin_gte),
+    DEFINE_BUILTIN_VARIADIC("<", 2, builtin_lt),
+    DEFINE_BUILTIN_VARIADIC(">", 2, builtin_gt),
+    DEFINE_BUILTIN_VARIADIC("<=", 2, builtin_lte),
+    DEFINE_BUILTIN_VARIADIC(">=", 2, builtin_gte),
     DEFINE_BUILTIN("==", 2, builtin_eq),
     DEFINE_BUILTIN("!=", 2, builtin_neq),
     DEFINE_BUILTIN("!", 1, builtin_not),
@@ -872,12 +1141,18 @@ BuiltinDef builtin_def_list[] = {
     DEFINE_BUILTIN("car", 1, builtin_car),
     DEFINE_BUILTIN("cdr", 1, builtin_cdr),
     DEFINE_BUILTIN("cons", 2, builtin_cons),
-    DEFINE_BUILTIN("eval", 1, builtin_eval),
+    DEFINE_BUILTIN_VARIADIC("make-vector", 1, builtin_make_vector),
+    DEFINE_BUILTIN("vector-ref", 2, builtin_vector_ref),
+    DEFINE_BUILTIN("vector-set!", 3, builtin_vector_set),
+    DEFINE_BUILTIN("vector-length", 1, builtin_vector_length),
+    DEFINE_BUILTIN("list->vector", 1, builtin_list_to_vector),
+    DEFINE_BUILTIN_NON_LEAF("eval", 1, builtin_eval),
     DEFINE_BUILTIN("print", 1, builtin_print),
+    DEFINE_BUILTIN("gc-stats", 0, builtin_gc_stats),
 
     DEFINE_BUILTIN_NO_EVAL("and", 2, builtin_and),
     DEFINE_BUILTIN_NO_EVAL("or", 2, builtin_or),
-    DEFINE_BUILTIN_NO_EVAL("if", 3, builtin_if),
+    DEFINE_BUILTIN_TAIL("if", 3, builtin_if),
 
     DEFINE_BUILTIN_NO_EVAL("function", 1, builtin_function),
     DEFINE_BUILTIN_NO_EVAL("lambda", 2, builtin_lambda),
@@ -885,19 +1160,18 @@ BuiltinDef builtin_def_list[] = {
     DEFINE_BUILTIN_NO_EVAL("quote", 1, builtin_quote),
     DEFINE_BUILTIN_NO_EVAL("set", 2, builtin_set),
 
-    DEFINE_BUILTIN_NO_EVAL_VARIADIC("begin", builtin_begin),
-    DEFINE_BUILTIN_NO_EVAL_VARIADIC("cond", builtin_cond),
+    DEFINE_BUILTIN_TAIL_VARIADIC("begin", builtin_begin),
+    DEFINE_BUILTIN_TAIL_VARIADIC("cond", builtin_cond),
     DEFINE_BUILTIN_NO_EVAL_VARIADIC("define", builtin_define),
-    DEFINE_BUILTIN_NO_EVAL_VARIADIC("funcall", builtin_funcall),
+    DEFINE_BUILTIN_TAIL_VARIADIC("funcall", builtin_funcall),
 };
 
-bool lookup_builtin(s8 id, BuiltinDef* out) {
+const BuiltinDef* find_builtin(s8 id) {
     for (size_t i = 0; i < countof(builtin_def_list); i++) {
         if (s8_equals(id, builtin_def_list[i].name)) {
-            if (out != NULL) *out = builtin_def_list[i];
-            return true;
+            return &builtin_def_list[i];
         }
     }
 
-    return false;
+    return NULL;
 }
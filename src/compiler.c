@@ -0,0 +1,673 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin.h"
+#include "common.h"
+#include "compiler.h"
+#include "sexpr.h"
+#include "util.h"
+#include "vm.h"
+
+typedef struct {
+    Vm* vm;
+
+    uint8_t* bytes;
+    size_t length;
+    size_t capacity;
+
+    // Nothing is allocated while compiling, so the constants don't need to be
+    // rooted until the code is.
+    SExpr** constants;
+    size_t constant_count;
+    size_t constant_capacity;
+
+    // The number of closure caches, which are stored after the constants.
+    size_t cache_count;
+
+    size_t depth;
+    size_t max_depth;
+
+    // Cleared once a form is found that can't be compiled or doesn't fit in
+    // an operand.
+    bool ok;
+} Compiler;
+
+typedef struct {
+    s8 name;
+    OpCode op;
+    // The number of arguments the instruction pops.
+    size_t arg_count;
+} Instruction;
+
+// Builtins with their own instruction, which is used instead of a call
+// whenever it can produce the same result.
+static const Instruction instructions[] = {
+    { s8("add"), OP_ADD, 2 },
+    { s8("sub"), OP_SUB, 2 },
+    { s8("mul"), OP_MUL, 2 },
+    { s8("div"), OP_DIV, 2 },
+    { s8("+"), OP_ADD, 2 },
+    { s8("-"), OP_SUB, 2 },
+    { s8("*"), OP_MUL, 2 },
+    { s8("/"), OP_DIV, 2 },
+    { s8("lt"), OP_LT, 2 },
+    { s8("gt"), OP_GT, 2 },
+    { s8("lte"), OP_LTE, 2 },
+    { s8("gte"), OP_GTE, 2 },
+    { s8("<"), OP_LT, 2 },
+    { s8(">"), OP_GT, 2 },
+    { s8("<="), OP_LTE, 2 },
+    { s8(">="), OP_GTE, 2 },
+    { s8("nil?"), OP_NOT, 1 },
+    { s8("not"), OP_NOT, 1 },
+    { s8("!"), OP_NOT, 1 },
+    { s8("cons"), OP_CONS, 2 },
+};
+
+static bool is_form(Vm* vm, SExpr* head, s8 name) {
+    return IS_SYMBOL(head) && head == vm_find_symbol(vm, name);
+}
+
+// Returns `true` if `list` is a proper list, storing its length in `*length`.
+static bool list_length(SExpr* list, size_t* length) {
+    *length = 0;
+    while (!IS_NIL(list)) {
+        if (!IS_CONS(list)) return false;
+
+        *length += 1;
+        list = EXTRACT_CDR(list);
+    }
+
+    return true;
+}
+
+static void emit_byte(Compiler* compiler, uint8_t byte) {
+    if (compiler->length >= compiler->capacity) {
+        bool success =
+            GROW(&compiler->bytes, &compiler->capacity, sizeof(uint8_t), 64);
+        if (!success) {
+            fprintf(stderr, "memory allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    compiler->bytes[compiler->length] = byte;
+    compiler->length += 1;
+}
+
+static void emit_operand(Compiler* compiler, size_t operand) {
+    if (operand > UINT16_MAX) {
+        compiler->ok = false;
+        operand = 0;
+    }
+
+    emit_byte(compiler, (uint8_t) (operand & 0xff));
+    emit_byte(compiler, (uint8_t) (operand >> 8));
+}
+
+// Emits `op` followed by a single operand.
+static void emit_op(Compiler* compiler, OpCode op, size_t operand) {
+    emit_byte(compiler, (uint8_t) op);
+    emit_operand(compiler, operand);
+}
+
+// Emits a jump, returning the offset of its target to be patched later.
+static size_t emit_jump(Compiler* compiler, OpCode op) {
+    emit_byte(compiler, (uint8_t) op);
+    size_t target = compiler->length;
+    emit_operand(compiler, 0);
+
+    return target;
+}
+
+// Points the jump target at `target` to the next instruction.
+static void patch_jump(Compiler* compiler, size_t target) {
+    size_t offset = compiler->length;
+    if (offset > UINT16_MAX) {
+        compiler->ok = false;
+        return;
+    }
+
+    compiler->bytes[target] = (uint8_t) (offset & 0xff);
+    compiler->bytes[target + 1] = (uint8_t) (offset >> 8);
+}
+
+static void push(Compiler* compiler, size_t count) {
+    compiler->depth += count;
+    if (compiler->depth > compiler->max_depth) {
+        compiler->max_depth = compiler->depth;
+    }
+}
+
+static void pop(Compiler* compiler, size_t count) {
+    // A form that failed to compile may not have pushed its value.
+    compiler->depth = compiler->depth < count ? 0 : compiler->depth - count;
+}
+
+static size_t add_constant(Compiler* compiler, SExpr* constant) {
+    for (size_t i = 0; i < compiler->constant_count; i++) {
+        if (compiler->constants[i] == constant) return i;
+    }
+
+    if (compiler->constant_count >= compiler->constant_capacity) {
+        bool success = GROW(
+            &compiler->constants,
+            &compiler->constant_capacity,
+            sizeof(SExpr*),
+            16
+        );
+        if (!success) {
+            fprintf(stderr, "memory allocation error\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    compiler->constants[compiler->constant_count] = constant;
+    compiler->constant_count += 1;
+    return compiler->constant_count - 1;
+}
+
+static void compile_expr(Compiler* compiler, SExpr* sexpr, bool tail);
+
+// Compiles a form that is left to `eval_internal`.
+static void compile_eval(Compiler* compiler, SExpr* form) {
+    emit_op(compiler, OP_EVAL, add_constant(compiler, form));
+    push(compiler, 1);
+}
+
+// Returns `true` if `form` is a `let` or `set` of a symbol that can be
+// compiled as a statement.
+static bool is_binding(SExpr* form) {
+    size_t arg_count;
+    if (!list_length(EXTRACT_CDR(form), &arg_count)) return false;
+
+    return arg_count == 2 && IS_SYMBOL(EXTRACT_CAR(EXTRACT_CDR(form)));
+}
+
+// Compiles the forms of a `begin`, leaving the value of the last form that
+// produces one.
+//
+// `let` only binds into the function's frame when it is directly part of the
+// function's body, so it is rejected anywhere else.
+static void compile_sequence(
+    Compiler* compiler,
+    SExpr* forms,
+    bool body,
+    bool tail
+) {
+    Vm* vm = compiler->vm;
+
+    bool has_value = false;
+    while (!IS_NIL(forms)) {
+        SExpr* form = EXTRACT_CAR(forms);
+        SExpr* head = IS_NIL(form) || !IS_CONS(form) ? NIL : EXTRACT_CAR(form);
+
+        bool let = is_form(vm, head, s8("let"));
+        if (let || is_form(vm, head, s8("set"))) {
+            if (!is_binding(form) || (let && !body)) {
+                compiler->ok = false;
+                return;
+            }
+
+            SExpr* args = EXTRACT_CDR(form);
+            compile_expr(compiler, EXTRACT_CAR(EXTRACT_CDR(args)), false);
+            emit_op(
+                compiler,
+                let ? OP_LET : OP_SET,
+                add_constant(compiler, EXTRACT_CAR(args))
+            );
+            pop(compiler, 1);
+        } else if (is_form(vm, head, s8("define"))) {
+            // Like `let` and `set`, `define` doesn't change the result.
+            compile_eval(compiler, form);
+            emit_byte(compiler, OP_POP);
+            pop(compiler, 1);
+        } else {
+            if (has_value) {
+                emit_byte(compiler, OP_POP);
+                pop(compiler, 1);
+            }
+
+            compile_expr(compiler, form, tail && IS_NIL(EXTRACT_CDR(forms)));
+            has_value = true;
+        }
+
+        forms = EXTRACT_CDR(forms);
+    }
+
+    if (!has_value) {
+        emit_op(compiler, OP_CONST, add_constant(compiler, NIL));
+        push(compiler, 1);
+    }
+}
+
+static void compile_if(Compiler* compiler, SExpr* args, bool tail) {
+    compile_expr(compiler, EXTRACT_CAR(args), false);
+    size_t else_jump = emit_jump(compiler, OP_JUMP_IF_NIL);
+    pop(compiler, 1);
+
+    args = EXTRACT_CDR(args);
+    compile_expr(compiler, EXTRACT_CAR(args), tail);
+    size_t end_jump = emit_jump(compiler, OP_JUMP);
+    pop(compiler, 1);
+
+    patch_jump(compiler, else_jump);
+    compile_expr(compiler, EXTRACT_CAR(EXTRACT_CDR(args)), tail);
+    patch_jump(compiler, end_jump);
+}
+
+static void compile_and(Compiler* compiler, SExpr* args, bool tail) {
+    compile_expr(compiler, EXTRACT_CAR(args), false);
+    size_t false_jump = emit_jump(compiler, OP_JUMP_IF_NIL);
+    pop(compiler, 1);
+
+    compile_expr(compiler, EXTRACT_CAR(EXTRACT_CDR(args)), tail);
+    size_t end_jump = emit_jump(compiler, OP_JUMP);
+    pop(compiler, 1);
+
+    patch_jump(compiler, false_jump);
+    emit_op(compiler, OP_CONST, add_constant(compiler, NIL));
+    push(compiler, 1);
+    patch_jump(compiler, end_jump);
+}
+
+// Returns `true` if every clause of a `cond` is a list with a test and a
+// value, so that it can't fail before running.
+static bool valid_clauses(SExpr* clauses) {
+    while (!IS_NIL(clauses)) {
+        SExpr* clause = EXTRACT_CAR(clauses);
+        if (IS_NIL(clause) || !IS_CONS(clause)) return false;
+        if (IS_NIL(EXTRACT_CDR(clause)) || !IS_CONS(EXTRACT_CDR(clause))) {
+            return false;
+        }
+
+        clauses = EXTRACT_CDR(clauses);
+    }
+
+    return true;
+}
+
+static void compile_cond(
+    Compiler* compiler,
+    SExpr* head,
+    SExpr* clauses,
+    bool tail
+) {
+    // Each clause that matches jumps to the end, which is patched through the
+    // chain of jumps once it is known.
+    size_t* end_jumps = NULL;
+    size_t end_jump_count = 0;
+    size_t end_jump_capacity = 0;
+
+    while (!IS_NIL(clauses)) {
+        SExpr* clause = EXTRACT_CAR(clauses);
+
+        compile_expr(compiler, EXTRACT_CAR(clause), false);
+        size_t next_jump = emit_jump(compiler, OP_JUMP_IF_NIL);
+        pop(compiler, 1);
+
+        compile_expr(compiler, EXTRACT_CAR(EXTRACT_CDR(clause)), tail);
+        pop(compiler, 1);
+
+        if (end_jump_count >= end_jump_capacity) {
+            bool success = GROW(
+                &end_jumps,
+                &end_jump_capacity,
+                sizeof(size_t),
+                8
+            );
+            if (!success) {
+                fprintf(stderr, "memory allocation error\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        end_jumps[end_jump_count] = emit_jump(compiler, OP_JUMP);
+        end_jump_count += 1;
+
+        patch_jump(compiler, next_jump);
+        clauses = EXTRACT_CDR(clauses);
+    }
+
+    emit_op(compiler, OP_COND_FAIL, add_constant(compiler, head));
+    for (size_t i = 0; i < end_jump_count; i++) {
+        patch_jump(compiler, end_jumps[i]);
+    }
+    push(compiler, 1);
+
+    free(end_jumps);
+}
+
+// Compiles a call of a function defined with `define`.
+//
+// A call in tail position may replace the calling function's frame, since
+// nothing is left to do in it once the call returns.
+static void compile_call(
+    Compiler* compiler,
+    SExpr* form,
+    size_t arg_count,
+    bool tail
+) {
+    emit_op(compiler, OP_PREPARE, add_constant(compiler, form));
+    emit_operand(compiler, arg_count);
+    emit_operand(compiler, compiler->cache_count);
+    compiler->cache_count += 1;
+    push(compiler, 1);
+
+    SExpr* arg = EXTRACT_CDR(form);
+    while (!IS_NIL(arg)) {
+        compile_expr(compiler, EXTRACT_CAR(arg), false);
+        arg = EXTRACT_CDR(arg);
+    }
+
+    emit_op(compiler, tail ? OP_TAIL_CALL : OP_CALL, arg_count);
+    pop(compiler, arg_count + 1);
+    push(compiler, 1);
+}
+
+static void compile_builtin(
+    Compiler* compiler,
+    SExpr* head,
+    const BuiltinDef* builtin,
+    SExpr* args,
+    size_t arg_count
+) {
+    SExpr* arg = args;
+    while (!IS_NIL(arg)) {
+        compile_expr(compiler, EXTRACT_CAR(arg), false);
+        arg = EXTRACT_CDR(arg);
+    }
+
+    for (size_t i = 0; i < countof(instructions); i++) {
+        if (!s8_equals(builtin->name, instructions[i].name)) continue;
+        if (arg_count != instructions[i].arg_count) break;
+
+        OpCode op = instructions[i].op;
+        if (op == OP_NOT || op == OP_CONS) {
+            emit_byte(compiler, (uint8_t) op);
+        } else {
+            emit_op(compiler, op, add_constant(compiler, head));
+        }
+
+        pop(compiler, arg_count);
+        push(compiler, 1);
+        return;
+    }
+
+    emit_op(compiler, OP_BUILTIN, add_constant(compiler, head));
+    emit_operand(compiler, arg_count);
+    pop(compiler, arg_count);
+    push(compiler, 1);
+}
+
+static void compile_form(Compiler* compiler, SExpr* form, bool tail) {
+    Vm* vm = compiler->vm;
+    SExpr* head = EXTRACT_CAR(form);
+    SExpr* args = EXTRACT_CDR(form);
+
+    // Lambda expressions and malformed calls are left to the evaluator, which
+    // also reports their errors.
+    size_t arg_count;
+    if (!IS_SYMBOL(head) || !list_length(args, &arg_count)) {
+        compile_eval(compiler, form);
+        return;
+    }
+
+    const BuiltinDef* builtin = lookup_builtin(head);
+    if (builtin == NULL) {
+        compile_call(compiler, form, arg_count, tail);
+        return;
+    }
+
+    if (is_form(vm, head, s8("quote")) && arg_count == 1) {
+        emit_op(compiler, OP_CONST, add_constant(compiler, EXTRACT_CAR(args)));
+        push(compiler, 1);
+    } else if (is_form(vm, head, s8("if")) && arg_count == 3) {
+        compile_if(compiler, args, tail);
+    } else if (is_form(vm, head, s8("and")) && arg_count == 2) {
+        compile_and(compiler, args, tail);
+    } else if (is_form(vm, head, s8("cond")) && valid_clauses(args)) {
+        compile_cond(compiler, head, args, tail);
+    } else if (is_form(vm, head, s8("begin")) && arg_count != 0) {
+        compile_sequence(compiler, args, false, tail);
+    } else if (is_form(vm, head, s8("let")) || is_form(vm, head, s8("set"))) {
+        // The result of a binding is whatever the enclosing form last
+        // produced, which the stack doesn't track.
+        compiler->ok = false;
+    } else if (!builtin->eval_args) {
+        compile_eval(compiler, form);
+    } else if (!builtin_accepts(builtin, arg_count)) {
+        compile_eval(compiler, form);
+    } else {
+        compile_builtin(compiler, head, builtin, args, arg_count);
+    }
+}
+
+static void compile_expr(Compiler* compiler, SExpr* sexpr, bool tail) {
+    if (!compiler->ok) return;
+
+    if (IS_NIL(sexpr) || IS_NUMBER(sexpr) || IS_STRING(sexpr)) {
+        emit_op(compiler, OP_CONST, add_constant(compiler, sexpr));
+        push(compiler, 1);
+    } else if (IS_SYMBOL(sexpr)) {
+        emit_op(compiler, OP_LOOKUP, add_constant(compiler, sexpr));
+        push(compiler, 1);
+    } else if (IS_LOCAL(sexpr)) {
+        emit_op(compiler, OP_LOCAL, AS_LOCAL(sexpr)->slot);
+        push(compiler, 1);
+    } else if (IS_CONS(sexpr)) {
+        compile_form(compiler, sexpr, tail);
+    } else {
+        compiler->ok = false;
+    }
+}
+
+SExpr* compile_function(Vm* vm, SExpr* params, SExpr* body) {
+    size_t form_count;
+    bool is_body = !IS_NIL(body)
+        && IS_CONS(body)
+        && is_form(vm, EXTRACT_CAR(body), s8("begin"))
+        && list_length(EXTRACT_CDR(body), &form_count)
+        && form_count != 0;
+    if (!is_body) return body;
+
+    Compiler compiler;
+    memset(&compiler, 0, sizeof(Compiler));
+    compiler.vm = vm;
+    compiler.ok = true;
+
+    compile_sequence(&compiler, EXTRACT_CDR(body), true, true);
+    emit_byte(&compiler, OP_RETURN);
+
+    SExpr* code = body;
+    if (!compiler.ok) goto cleanup;
+
+    // Root the constants alongside the body while the code is allocated.
+    size_t root_count = compiler.constant_count + 2;
+    void** roots = (void**) malloc(root_count * sizeof(void*));
+    if (roots == NULL) {
+        fprintf(stderr, "memory allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < compiler.constant_count; i++) {
+        roots[i] = &compiler.constants[i];
+    }
+    roots[compiler.constant_count] = &params;
+    roots[compiler.constant_count + 1] = &body;
+
+    GcFrame frame = { vm->gc.frames, root_count, roots };
+    vm->gc.frames = &frame;
+    code = vm_alloc_code(
+        vm,
+        body,
+        params,
+        compiler.constant_count + compiler.cache_count,
+        compiler.length
+    );
+    ASSERT(vm->gc.frames == &frame, "gc frames must be ended in order");
+    vm->gc.frames = frame.prev;
+    free(roots);
+
+    SExprCode* fields = AS_CODE(code);
+    fields->max_stack = compiler.max_depth;
+    fields->cache_count = compiler.cache_count;
+    memcpy(
+        fields->constants,
+        compiler.constants,
+        compiler.constant_count * sizeof(SExpr*)
+    );
+    memcpy(sexpr_code_bytes(fields), compiler.bytes, compiler.length);
+    VM_WRITE_BARRIER(vm, code);
+
+cleanup:
+    free(compiler.bytes);
+    free(compiler.constants);
+    return code;
+}
+
+#ifdef ENABLE_TESTS
+
+#include "eval.h"
+#include "parser.h"
+#include "test.h"
+
+// Returns the body of the function `name` as stored by `define`.
+static SExpr* compiler_test_body(Vm* vm, s8 name) {
+    SExpr* function = NIL;
+    SExpr* symbol = vm_find_symbol(vm, name);
+    if (!env_table_lookup(vm->funcs, symbol, &function)) return NIL;
+
+    return AS_CLOSURE(function)->body;
+}
+
+bool compiler_matches_interpreter() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+    SExpr* value = NULL;
+    VM_ROOT(&vm, &value);
+
+    value = eval_test_run(&vm, s8(
+        "(define fib (n)"
+        "  (cond ((lt n 2) n)"
+        "        ('t (+ (fib (- n 1)) (fib (- n 2))))))"
+        "(define sum (xs)"
+        "  (let total 0)"
+        "  (if (nil? xs) 0 (+ (car xs) (sum (cdr xs)))))"
+        "(define nested (x) (if x (let y 1) 0) y)"
+    ));
+
+    // Both definitions without nested bindings are compiled.
+    if (!IS_CODE(compiler_test_body(&vm, s8("fib")))) goto cleanup;
+    if (!IS_CODE(compiler_test_body(&vm, s8("sum")))) goto cleanup;
+    if (IS_CODE(compiler_test_body(&vm, s8("nested")))) goto cleanup;
+
+    value = eval_test_run(&vm, s8("(fib 15)"));
+    if (!IS_NUMBER(value) || EXTRACT_NUMBER(value) != 610) goto cleanup;
+
+    value = eval_test_run(&vm, s8("(sum '(1 2 3))"));
+    if (!IS_NUMBER(value) || EXTRACT_NUMBER(value) != 6) goto cleanup;
+
+    // Errors are still reported through the context.
+    value = eval_test_run(&vm, s8("(define bad (x) (+ x 'a))"));
+    Parser parser;
+    parser_init_s8(&parser, s8("(bad 1)"));
+    ParseResult parsed;
+    bool success = parser_next_sexpr(&vm, &parser, &parsed) && parsed.ok;
+    parser_free(&parser);
+    if (!success || eval(&vm, parsed.as.ok).ok) goto cleanup;
+
+    result = true;
+cleanup:
+    VM_UNROOT(&vm, &value);
+    vm_free(&vm);
+    return result;
+}
+
+bool compiler_eliminates_tail_calls() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+    SExpr* value = NULL;
+    VM_ROOT(&vm, &value);
+
+    // Far deeper than the stack depth limit.
+    value = eval_test_run(&vm, s8(
+        "(define even (n) (if (lt n 1) 't (odd (- n 1))))"
+        "(define odd (n) (if (lt n 1) () (even (- n 1))))"
+        "(even 10000)"
+    ));
+    if (!IS_SYMBOL(value)) goto cleanup;
+
+    // The callee still sees the parameters of the caller it replaces.
+    value = eval_test_run(&vm, s8(
+        "(define helper () x)"
+        "(define visible (x) (helper))"
+        "(visible 7)"
+    ));
+    if (!IS_NUMBER(value) || EXTRACT_NUMBER(value) != 7) goto cleanup;
+
+    // Loops through differently named parameters run in constant depth too.
+    value = eval_test_run(&vm, s8(
+        "(define ev (n) (if (lt n 1) 't (od (- n 1))))"
+        "(define od (m) (if (lt m 1) () (ev (- m 1))))"
+        "(ev 10000)"
+    ));
+    if (!IS_SYMBOL(value)) goto cleanup;
+
+    // So do lambdas, which are evaluated by the tree-walker.
+    value = eval_test_run(&vm, s8(
+        "(let step (lambda (k) (if (lt k 1) 't (funcall step (- k 1)))))"
+        "(funcall step 10000)"
+    ));
+    if (!IS_SYMBOL(value)) goto cleanup;
+
+    result = true;
+cleanup:
+    VM_UNROOT(&vm, &value);
+    vm_free(&vm);
+    return result;
+}
+
+bool compiler_caches_called_functions() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    s8 input = s8("(define f (x) (+ x 1)) (define g (x) (f (f x))) (g 1)");
+    if (!eval_test_number(&vm, input, 3)) goto cleanup;
+
+    // Redefining the callee invalidates the closure cached by the caller.
+    input = s8("(define f (x) (* x 10)) (g 1)");
+    if (!eval_test_number(&vm, input, 100)) goto cleanup;
+
+    SExpr* code = compiler_test_body(&vm, s8("g"));
+    if (!IS_CODE(code) || AS_CODE(code)->cache_count != 2) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+TestDefinition compiler_tests[] = {
+    DEFINE_UNIT_TEST(compiler_caches_called_functions, 0),
+    DEFINE_UNIT_TEST(compiler_eliminates_tail_calls, 0),
+    DEFINE_UNIT_TEST(compiler_matches_interpreter, 0),
+};
+
+TestList compiler_test_list = (TestList) {
+    compiler_tests,
+    countof(compiler_tests)
+};
+
+#endif
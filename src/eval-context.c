@@ -5,44 +5,11 @@
 #include "eval-context.h"
 #include "gc.h"
 #include "sexpr.h"
+#include "util.h"
 #include "vm.h"
 
-#define EVAL_FRAME_TYPE_ID 5
-#define EVAL_CONTEXT_TYPE_ID 6
-
-typedef enum {
-    // An argument has an invalid type.
-    //
-    // `arg_index`, `sexpr`, and `sexpr_type` are active.
-    ARG_INVALID_TYPE,
-    // An argument to `cond` is not a pair.
-    //
-    // `arg_index` and `sexpr` are active.
-    COND_ARG_NOT_PAIR,
-    // An argument list is dotted.
-    //
-    // `arg_index` and `sexpr` are active.
-    DOTTED_ARG_LIST,
-    // The number of arguments to a function is either less than or greater
-    // than the defined number.
-    //
-    // `arg_index` is active and is the required number of arguments.
-    ERRONOUS_ARG_COUNT,
-    // The function call is illegal.
-    //
-    // `sexpr` is active.
-    ILLEGAL_FUNC_CALL,
-    // An argument defined in function is not a symbol.
-    //
-    // `arg_index` and `sexpr` are active.
-    INVALID_ARG_DEF_TYPE,
-    // Lookup of a function or a variable failed.
-    //
-    // `sexpr` is active.
-    SYMBOL_LOOKUP_FAILED,
-    // The maximum stack depth allowed was reached.
-    MAX_STACK_DEPTH_REACHED,
-} ErrorType;
+#define EVAL_FRAME_TYPE_ID 9
+#define EVAL_CONTEXT_TYPE_ID 10
 
 typedef struct EvalFrame EvalFrame;
 struct EvalFrame {
@@ -51,9 +18,19 @@ struct EvalFrame {
     SExpr* function_id;
 
     bool valid_env;
+    // Allocated by the first binding added to the frame, and `NIL` until
+    // then.
     Environment env;
 
+    // The nearest frame, possibly this one, whose parameters are bound. Local
+    // references are read from its slots.
+    EvalFrame* scope;
+
     EvalFrame* next;
+
+    // The function's parameters followed by their values once bound.
+    size_t local_count;
+    SExpr* locals[];
 };
 
 struct EvalContext {
@@ -61,12 +38,14 @@ struct EvalContext {
 
     bool has_error;
 
-    ErrorType error;
+    EvalErrorType error;
     size_t arg_index;
     SExpr* sexpr;
     SExprType sexpr_type;
 
     EvalFrame* frame;
+    // The number of frames in `frame`.
+    size_t depth;
 };
 
 EvalContext* eval_context_alloc(Vm* vm) {
@@ -76,10 +55,12 @@ EvalContext* eval_context_alloc(Vm* vm) {
     context->has_error = false;
 
     context->error = ARG_INVALID_TYPE;
+    context->arg_index = 0;
     context->sexpr = NULL;
     context->sexpr_type = SEXPR_SYMBOL;
 
     context->frame = NULL;
+    context->depth = 0;
 
     return context;
 }
@@ -88,6 +69,37 @@ bool eval_context_is_ok(EvalContext* context) {
     return !context->has_error;
 }
 
+EvalErrorType eval_context_error(const EvalContext* context) {
+    ASSERT(context->has_error, "context has no error");
+    return context->error;
+}
+
+size_t eval_context_arg_index(const EvalContext* context) {
+    return context->arg_index;
+}
+
+// Binds `symbol` to `value` in the environment of `frame`, allocating the
+// environment if it has none yet.
+static void eval_frame_bind(
+    Vm* vm,
+    EvalFrame* frame,
+    SExpr* symbol,
+    SExpr* value
+) {
+    VM_FRAME_BEGIN(vm, &frame, &symbol, &value);
+
+    if (IS_NIL(frame->env.list)) {
+        Environment env = { NULL };
+        env_init(vm, &env);
+        frame->env = env;
+        VM_WRITE_BARRIER(vm, frame);
+    }
+
+    env_set(vm, &frame->env, symbol, value);
+
+    VM_FRAME_END(vm);
+}
+
 void eval_context_add_symbol(
     Vm* vm,
     EvalContext* context,
@@ -99,14 +111,12 @@ void eval_context_add_symbol(
         frame = frame->next;
     }
 
-    Environment* env;
     if (frame == NULL) {
-        env = &vm->vars;
-    } else {
-        env = &frame->env;
+        env_table_set(vm, &vm->vars, symbol, value);
+        return;
     }
 
-    env_set(vm, env, symbol, value);
+    eval_frame_bind(vm, frame, symbol, value);
 }
 
 void eval_context_disable_local_env(EvalContext* context) {
@@ -115,6 +125,30 @@ void eval_context_disable_local_env(EvalContext* context) {
     context->frame->valid_env = false;
 }
 
+static bool eval_frame_lookup(
+    EvalFrame* frame,
+    SExpr* symbol,
+    SExpr** result
+) {
+    if (!IS_NIL(frame->env.list) && env_lookup(&frame->env, symbol, result)) {
+        return true;
+    }
+
+    if (frame->scope != frame) {
+        return false;
+    }
+
+    // Later parameters shadow earlier ones with the same name.
+    for (size_t slot = frame->local_count; slot > 0; slot--) {
+        if (frame->locals[slot - 1] == symbol) {
+            *result = frame->locals[frame->local_count + slot - 1];
+            return true;
+        }
+    }
+
+    return false;
+}
+
 bool eval_context_lookup(
     Vm* vm,
     EvalContext* context,
@@ -123,64 +157,255 @@ bool eval_context_lookup(
 ) {
     EvalFrame* frame = context->frame;
     while (frame != NULL) {
-        if (env_lookup(&frame->env, symbol, result)) {
+        if (eval_frame_lookup(frame, symbol, result)) {
             return true;
         }
 
         frame = frame->next;
     }
 
-    if (env_lookup(&vm->vars, symbol, result)) {
+    if (env_table_lookup(vm->vars, symbol, result)) {
         return true;
     }
 
     return false;
 }
 
-void eval_context_push_frame(Vm* vm, EvalContext* context, SExpr* id) {
-    VM_ROOT(vm, &context);
-    VM_ROOT(vm, &id);
+bool eval_context_lookup_local(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* local,
+    SExpr** result
+) {
+    SExprLocal* ref = AS_LOCAL(local);
+    EvalFrame* scope = context->frame == NULL ? NULL : context->frame->scope;
+
+    bool resolved = scope != NULL
+        && ref->slot < scope->local_count
+        && scope->locals[ref->slot] == ref->symbol;
+    if (resolved) {
+        *result = scope->locals[scope->local_count + ref->slot];
+        return true;
+    }
 
-    Environment env;
-    env_init(vm, &env);
+    // The reference escaped the function it was resolved for, for example
+    // through `eval`, so fall back to looking it up by name.
+    return eval_context_lookup(vm, context, ref->symbol, result);
+}
 
-    VM_ROOT(vm, &env.list);
-    EvalFrame* frame =
-        (EvalFrame*) gc_alloc(&vm->gc, EVAL_FRAME_TYPE_ID, sizeof(EvalFrame));
-    VM_UNROOT(vm, &env.list);
+void eval_context_push_frame(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr* params
+) {
+    VM_FRAME_BEGIN(vm, &context, &id, &params);
+
+    size_t local_count = 0;
+    SExpr* param = params;
+    while (!IS_NIL(param) && IS_CONS(param)) {
+        local_count += 1;
+        param = EXTRACT_CDR(param);
+    }
+
+    EvalFrame* frame = (EvalFrame*) gc_alloc(
+        &vm->gc,
+        EVAL_FRAME_TYPE_ID,
+        sizeof(EvalFrame) + 2 * local_count * sizeof(SExpr*)
+    );
 
     frame->function_id = id;
 
     frame->valid_env = true;
-    frame->env = env;
+    frame->env.list = NIL;
+
+    // Arguments are evaluated in this frame, but before the parameters are
+    // bound, so they must still see the caller's locals.
+    frame->scope = context->frame == NULL ? NULL : context->frame->scope;
+
+    frame->local_count = local_count;
+    for (size_t slot = 0; slot < local_count; slot++) {
+        frame->locals[slot] = EXTRACT_CAR(params);
+        frame->locals[local_count + slot] = NIL;
+        params = EXTRACT_CDR(params);
+    }
 
     frame->next = context->frame;
     context->frame = frame;
+    context->depth += 1;
+    VM_WRITE_BARRIER(vm, context);
+
+    VM_FRAME_END(vm);
+}
 
-    VM_UNROOT(vm, &id);
-    VM_UNROOT(vm, &context);
+void eval_context_bind_locals(Vm* vm, EvalContext* context, SExpr** values) {
+    EvalFrame* frame = context->frame;
+    ASSERT(frame != NULL);
+
+    for (size_t slot = 0; slot < frame->local_count; slot++) {
+        frame->locals[frame->local_count + slot] = values[slot];
+    }
+
+    frame->scope = frame;
+    VM_WRITE_BARRIER(vm, frame);
+}
+
+bool eval_context_binds(EvalContext* context, SExpr* params) {
+    EvalFrame* frame = context->frame;
+    if (frame == NULL || frame->scope != frame) return false;
+
+    size_t slot = 0;
+    while (!IS_NIL(params) && IS_CONS(params)) {
+        if (slot >= frame->local_count) return false;
+        if (frame->locals[slot] != EXTRACT_CAR(params)) return false;
+
+        slot += 1;
+        params = EXTRACT_CDR(params);
+    }
+
+    return slot == frame->local_count;
+}
+
+SExpr* eval_context_local(EvalContext* context, size_t slot) {
+    EvalFrame* scope = context->frame->scope;
+    ASSERT(slot < scope->local_count);
+
+    return scope->locals[scope->local_count + slot];
+}
+
+// Returns `true` if `symbol` is one of the parameters of `frame`.
+static bool eval_frame_has_param(EvalFrame* frame, SExpr* symbol) {
+    for (size_t slot = 0; slot < frame->local_count; slot++) {
+        if (frame->locals[slot] == symbol) return true;
+    }
+
+    return false;
+}
+
+bool eval_context_replace_caller(Vm* vm, EvalContext* context) {
+    EvalFrame* frame = context->frame;
+    ASSERT(frame != NULL && frame->scope == frame);
+
+    EvalFrame* caller = frame->next;
+    if (caller == NULL || caller->scope != caller) return false;
+
+    for (size_t slot = 0; slot < caller->local_count; slot++) {
+        if (!eval_frame_has_param(frame, caller->locals[slot])) return false;
+    }
+
+    // Variables bound by `let` are listed alongside their values.
+    SExpr* symbol =
+        IS_NIL(caller->env.list) ? NIL : EXTRACT_CAR(caller->env.list);
+    while (!IS_NIL(symbol)) {
+        if (!eval_frame_has_param(frame, EXTRACT_CAR(symbol))) return false;
+        symbol = EXTRACT_CDR(symbol);
+    }
+
+    frame->next = caller->next;
+    VM_WRITE_BARRIER(vm, frame);
+    context->depth -= 1;
+    return true;
 }
 
-void eval_context_pop_frame(EvalContext* context) {
+// Binds `symbol` to `value` in `frame` unless a lookup from `frame` would
+// already find it there.
+static void eval_frame_inherit(
+    Vm* vm,
+    EvalFrame* frame,
+    SExpr* symbol,
+    SExpr* value
+) {
+    SExpr* bound = NULL;
+    if (eval_frame_lookup(frame, symbol, &bound)) return;
+
+    eval_frame_bind(vm, frame, symbol, value);
+}
+
+void eval_context_replace_callers(
+    Vm* vm,
+    EvalContext* context,
+    size_t depth
+) {
+    EvalFrame* frame = context->frame;
+    if (frame == NULL || frame->scope != frame) return;
+    if (context->depth <= depth + 1) return;
+
+    EvalFrame* caller = frame->next;
+    SExpr* symbols = NIL;
+    SExpr* values = NIL;
+    VM_FRAME_BEGIN(vm, &context, &frame, &caller, &symbols, &values);
+
+    // Lookups from the current frame may still find what the removed frames
+    // bind, so that is copied into it in the order lookups would find it.
+    // The copies can't go stale, since nothing could have changed the
+    // removed frames before they were popped.
+    for (size_t i = context->depth - depth - 1; i > 0; i--) {
+        if (!IS_NIL(caller->env.list)) {
+            symbols = EXTRACT_CAR(caller->env.list);
+            values = EXTRACT_CAR(EXTRACT_CDR(caller->env.list));
+        }
+
+        while (!IS_NIL(symbols)) {
+            SExpr* symbol = EXTRACT_CAR(symbols);
+            eval_frame_inherit(vm, frame, symbol, EXTRACT_CAR(values));
+            symbols = EXTRACT_CDR(symbols);
+            values = EXTRACT_CDR(values);
+        }
+
+        size_t local_count = caller->scope == caller ? caller->local_count : 0;
+        for (size_t slot = local_count; slot > 0; slot--) {
+            eval_frame_inherit(
+                vm,
+                frame,
+                caller->locals[slot - 1],
+                caller->locals[local_count + slot - 1]
+            );
+        }
+
+        caller = caller->next;
+    }
+
+    frame->next = caller;
+    VM_WRITE_BARRIER(vm, frame);
+    context->depth = depth + 1;
+
+    VM_FRAME_END(vm);
+}
+
+void eval_context_pop_frame(Vm* vm, EvalContext* context) {
     if (context->frame == NULL) return;
     if (context->has_error) return; // Keep stack trace.
 
     context->frame = context->frame->next;
+    context->depth -= 1;
+    VM_WRITE_BARRIER(vm, context);
 }
 
-size_t eval_context_stack_depth(EvalContext* context) {
-    size_t depth = 0;
+void eval_context_pop_frames(Vm* vm, EvalContext* context, size_t depth) {
+    if (context->has_error) return; // Keep stack trace.
 
-    EvalFrame* frame = context->frame;
-    while (frame != NULL) {
-        depth += 1;
-        frame = frame->next;
+    while (context->depth > depth) {
+        context->frame = context->frame->next;
+        context->depth -= 1;
     }
+    VM_WRITE_BARRIER(vm, context);
+}
+
+size_t eval_context_stack_depth(EvalContext* context) {
+    return context->depth;
+}
+
+bool eval_context_check_depth(Vm* vm, EvalContext* context) {
+    bool available = context->depth < vm->max_stack_depth
+        && vm_native_stack_available(vm);
+    if (available) return true;
 
-    return depth;
+    eval_context_max_stack_depth_reached(context);
+    return false;
 }
 
 void eval_context_invalid_type(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* arg,
@@ -190,10 +415,12 @@ void eval_context_invalid_type(
     context->error = ARG_INVALID_TYPE;
     context->arg_index = arg_index;
     context->sexpr = arg;
+    VM_WRITE_BARRIER(vm, context);
     context->sexpr_type = type;
 }
 
 void eval_context_cond_arg_not_pair(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* not_pair
@@ -202,9 +429,11 @@ void eval_context_cond_arg_not_pair(
     context->error = COND_ARG_NOT_PAIR;
     context->arg_index = arg_index;
     context->sexpr = not_pair;
+    VM_WRITE_BARRIER(vm, context);
 }
 
 void eval_context_dotted_arg_list(
+    Vm* vm,
     EvalContext* context,
     size_t dotted_start,
     SExpr* arg_list
@@ -213,6 +442,7 @@ void eval_context_dotted_arg_list(
     context->error = DOTTED_ARG_LIST;
     context->arg_index = dotted_start;
     context->sexpr = arg_list;
+    VM_WRITE_BARRIER(vm, context);
 }
 
 void eval_context_erronous_arg_count(
@@ -225,15 +455,31 @@ void eval_context_erronous_arg_count(
 }
 
 void eval_context_illegal_call(
+    Vm* vm,
     EvalContext* context,
     SExpr* sexpr
 ) {
     context->has_error = true;
     context->error = ILLEGAL_FUNC_CALL;
     context->sexpr = sexpr;
+    VM_WRITE_BARRIER(vm, context);
+}
+
+void eval_context_index_out_of_range(
+    Vm* vm,
+    EvalContext* context,
+    size_t arg_index,
+    SExpr* index
+) {
+    context->has_error = true;
+    context->error = INDEX_OUT_OF_RANGE;
+    context->arg_index = arg_index;
+    context->sexpr = index;
+    VM_WRITE_BARRIER(vm, context);
 }
 
 void eval_context_invalid_arg_def_type(
+    Vm* vm,
     EvalContext* context,
     size_t arg_index,
     SExpr* arg_def
@@ -242,15 +488,18 @@ void eval_context_invalid_arg_def_type(
     context->error = INVALID_ARG_DEF_TYPE;
     context->arg_index = arg_index;
     context->sexpr = arg_def;
+    VM_WRITE_BARRIER(vm, context);
 }
 
 void eval_context_symbol_lookup_failed(
+    Vm* vm,
     EvalContext* context,
     SExpr* symbol
 ) {
     context->has_error = true;
     context->error = SYMBOL_LOOKUP_FAILED;
     context->sexpr = symbol;
+    VM_WRITE_BARRIER(vm, context);
 }
 
 void eval_context_max_stack_depth_reached(EvalContext* context) {
@@ -258,6 +507,11 @@ void eval_context_max_stack_depth_reached(EvalContext* context) {
     context->error = MAX_STACK_DEPTH_REACHED;
 }
 
+void eval_context_out_of_memory(EvalContext* context) {
+    context->has_error = true;
+    context->error = OUT_OF_MEMORY;
+}
+
 void eval_context_print(const EvalContext* context) {
     if (context->has_error) {
         switch (context->error) {
@@ -278,6 +532,18 @@ void eval_context_print(const EvalContext* context) {
                     case SEXPR_CONS:
                         printf("a cons cell");
                         break;
+                    case SEXPR_LOCAL:
+                        printf("local");
+                        break;
+                    case SEXPR_CODE:
+                        printf("code");
+                        break;
+                    case SEXPR_CLOSURE:
+                        printf("a function");
+                        break;
+                    case SEXPR_VECTOR:
+                        printf("a vector");
+                        break;
                 }
                 printf("\n");
                 break;
@@ -305,6 +571,11 @@ void eval_context_print(const EvalContext* context) {
                 PRINT_SEXPR(context->sexpr);
                 printf("`\n");
                 break;
+            case INDEX_OUT_OF_RANGE:
+                printf("argument %zu `", context->arg_index);
+                PRINT_SEXPR(context->sexpr);
+                printf("` is out of range\n");
+                break;
             case INVALID_ARG_DEF_TYPE:
                 printf("argument definition `");
                 PRINT_SEXPR(context->sexpr);
@@ -318,6 +589,9 @@ void eval_context_print(const EvalContext* context) {
             case MAX_STACK_DEPTH_REACHED:
                 printf("max stack depth reached\n");
                 break;
+            case OUT_OF_MEMORY:
+                printf("out of memory\n");
+                break;
         }
     }
 
@@ -356,8 +630,12 @@ void eval_context_print_raw(const EvalContext* context) {
 
         printf("\n\t\t\tenv: [");
 
-        SExpr* symbols = EXTRACT_CAR(frame->env.list);
-        SExpr* values = EXTRACT_CAR(EXTRACT_CDR(frame->env.list));
+        SExpr* symbols = NIL;
+        SExpr* values = NIL;
+        if (!IS_NIL(frame->env.list)) {
+            symbols = EXTRACT_CAR(frame->env.list);
+            values = EXTRACT_CAR(EXTRACT_CDR(frame->env.list));
+        }
         while (!IS_NIL(symbols)) {
             SExpr* symbol = EXTRACT_CAR(symbols);
             SExpr* value = EXTRACT_CAR(values);
@@ -371,6 +649,15 @@ void eval_context_print_raw(const EvalContext* context) {
             values = EXTRACT_CDR(values);
         }
         printf("\n\t\t\t]");
+
+        printf("\n\t\t\tlocals: [");
+        for (size_t slot = 0; slot < frame->local_count; slot++) {
+            printf("\n\t\t\t\t");
+            PRINT_SEXPR(frame->locals[slot]);
+            printf(" ");
+            PRINT_SEXPR(frame->locals[frame->local_count + slot]);
+        }
+        printf("\n\t\t\t]");
         printf("\n\t\t}\n");
 
         frame = frame->next;
@@ -383,88 +670,37 @@ size_t eval_context_size(GcObject* object) {
     return sizeof(EvalContext);
 }
 
-void eval_context_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    EvalContext* new = (EvalContext*) new_object;
-    EvalContext* old = (EvalContext*) object;
-
-    new->has_error = old->has_error;
+void eval_context_scan(Gc* gc, GcObject* object) {
+    EvalContext* context = (EvalContext*) object;
 
-    new->error = old->error;
-    new->arg_index = old->arg_index;
-    if (old->sexpr != NULL) {
-        new->sexpr = (SExpr*) gc_copy_object(gc, (GcObject*) old->sexpr);
-    } else {
-        new->sexpr = NULL;
-    }
-    new->sexpr_type = old->sexpr_type;
-
-    if (old->frame != NULL) {
-        new->frame = (EvalFrame*) gc_copy_object(gc, (GcObject*) old->frame);
-    } else {
-        new->frame = NULL;
-    }
-}
-
-GcObject* eval_context_get_children(GcObject* object, GcObject* position) {
-    GcObject* sexpr = (GcObject*) ((EvalContext*) object)->sexpr;
-    GcObject* frame = (GcObject*) ((EvalContext*) object)->frame;
-
-    if (position == NULL && sexpr != NULL) return sexpr;
-    if (
-        (position == NULL && sexpr == NULL)
-        || (position == sexpr && frame != NULL)
-    ) {
-        return frame;
-    }
-
-    return NULL;
+    GC_SCAN_FIELD(gc, context->sexpr);
+    GC_SCAN_FIELD(gc, context->frame);
 }
 
 size_t eval_frame_size(GcObject* object) {
-    return sizeof(EvalFrame);
+    return sizeof(EvalFrame)
+        + 2 * ((EvalFrame*) object)->local_count * sizeof(SExpr*);
 }
 
-void eval_frame_copy(Gc* gc, GcObject* object, GcObject* new_object) {
+void eval_frame_scan(Gc* gc, GcObject* object) {
     EvalFrame* frame = (EvalFrame*) object;
-    EvalFrame* new_frame = (EvalFrame*) new_object;
-
-    new_frame->function_id =
-        (SExpr*) gc_copy_object(gc, (GcObject*) frame->function_id);
 
-    new_frame->valid_env = frame->valid_env;
-    new_frame->env.list =
-        (SExpr*) gc_copy_object(gc, (GcObject*) frame->env.list);
+    GC_SCAN_FIELD(gc, frame->function_id);
+    GC_SCAN_FIELD(gc, frame->env.list);
+    GC_SCAN_FIELD(gc, frame->scope);
+    GC_SCAN_FIELD(gc, frame->next);
 
-    if (frame->next != NULL) {
-        new_frame->next =
-            (EvalFrame*) gc_copy_object(gc, (GcObject*) frame->next);
-    } else {
-        new_frame->next = NULL;
+    for (size_t i = 0; i < 2 * frame->local_count; i++) {
+        GC_SCAN_FIELD(gc, frame->locals[i]);
     }
 }
 
-GcObject* eval_frame_get_children(GcObject* object, GcObject* position) {
-    GcObject* function_id = (GcObject*) ((EvalFrame*) object)->function_id;
-    GcObject* env = (GcObject*) ((EvalFrame*) object)->env.list;
-    GcObject* next = (GcObject*) ((EvalFrame*) object)->next;
-
-    if (position == NULL && function_id != NULL)
-        return function_id;
-
-    if ((position == NULL && function_id == NULL) || position == function_id)
-        return env;
-
-    if (position != next) return (GcObject*) next;
-    return NULL;
-}
-
 void gc_add_eval_context(Gc* gc) {
     size_t type_id = gc_add_type(
         gc,
         alignof(EvalFrame),
         eval_frame_size,
-        eval_frame_copy,
-        eval_frame_get_children
+        eval_frame_scan
     );
     ASSERT(type_id == EVAL_FRAME_TYPE_ID);
 
@@ -472,8 +708,7 @@ void gc_add_eval_context(Gc* gc) {
         gc,
         alignof(EvalContext),
         eval_context_size,
-        eval_context_copy,
-        eval_context_get_children
+        eval_context_scan
     );
     ASSERT(type_id == EVAL_CONTEXT_TYPE_ID);
 }
@@ -481,11 +716,10 @@ void gc_add_eval_context(Gc* gc) {
 #ifdef ENABLE_TESTS
 
 #include "test.h"
-#include "util.h"
 
 bool eval_context_symbol_manipulation() {
     Vm vm;
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
 
     EvalContext* context = eval_context_alloc(&vm);
     VM_ROOT(&vm, &context);
@@ -497,7 +731,7 @@ bool eval_context_symbol_manipulation() {
     VM_ROOT(&vm, &value);
 
     symbol = vm_alloc_symbol(&vm, s8("Frame 0"));
-    eval_context_push_frame(&vm, context, symbol);
+    eval_context_push_frame(&vm, context, symbol, NIL);
 
     symbol = vm_alloc_symbol(&vm, s8("v"));
     value = vm_alloc_symbol(&vm, s8("test_0"));
@@ -509,7 +743,7 @@ bool eval_context_symbol_manipulation() {
     );
 
     symbol = vm_alloc_symbol(&vm, s8("Frame 1"));
-    eval_context_push_frame(&vm, context, symbol);
+    eval_context_push_frame(&vm, context, symbol, NIL);
 
     symbol = vm_alloc_symbol(&vm, s8("v"));
 
@@ -526,7 +760,7 @@ bool eval_context_symbol_manipulation() {
     eval_context_lookup(&vm, context, symbol, &sexpr_result);
     if (!s8_equals(s8("test_1"), EXTRACT_SYMBOL(sexpr_result))) goto cleanup;
 
-    eval_context_pop_frame(context);
+    eval_context_pop_frame(&vm, context);
     eval_context_lookup(&vm, context, symbol, &sexpr_result);
     if (!s8_equals(s8("test_0"), EXTRACT_SYMBOL(sexpr_result))) goto cleanup;
 
@@ -539,8 +773,76 @@ cleanup:
     return result;
 }
 
+bool eval_context_tracks_depth() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) return false;
+    vm.max_stack_depth = 2;
+
+    EvalContext* context = eval_context_alloc(&vm);
+    VM_ROOT(&vm, &context);
+
+    bool result = false;
+    SExpr* symbol = NULL;
+    VM_ROOT(&vm, &symbol);
+
+    symbol = vm_alloc_symbol(&vm, s8("f"));
+    eval_context_push_frame(&vm, context, symbol, NIL);
+    if (!eval_context_check_depth(&vm, context)) goto cleanup;
+
+    eval_context_push_frame(&vm, context, symbol, NIL);
+    if (eval_context_stack_depth(context) != 2) goto cleanup;
+    if (eval_context_check_depth(&vm, context)) goto cleanup;
+
+    // Frames are kept for the backtrace once an error is reported.
+    eval_context_pop_frame(&vm, context);
+    if (eval_context_stack_depth(context) != 2) goto cleanup;
+
+    result = true;
+cleanup:
+    VM_UNROOT(&vm, &symbol);
+    VM_UNROOT(&vm, &context);
+    vm_free(&vm);
+    return result;
+}
+
+bool eval_context_allocates_env_lazily() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) return false;
+
+    EvalContext* context = eval_context_alloc(&vm);
+    VM_ROOT(&vm, &context);
+
+    bool result = false;
+    SExpr* symbol = NULL;
+    SExpr* value = NULL;
+    VM_ROOT(&vm, &symbol);
+    VM_ROOT(&vm, &value);
+
+    symbol = vm_alloc_symbol(&vm, s8("x"));
+    value = vm_alloc_number(&vm, 1.5);
+    eval_context_push_frame(&vm, context, symbol, NIL);
+    if (!IS_NIL(context->frame->env.list)) goto cleanup;
+
+    eval_context_add_symbol(&vm, context, symbol, value);
+    if (IS_NIL(context->frame->env.list)) goto cleanup;
+
+    SExpr* found = NIL;
+    if (!eval_context_lookup(&vm, context, symbol, &found)) goto cleanup;
+    if (found != value) goto cleanup;
+
+    result = true;
+cleanup:
+    VM_UNROOT(&vm, &value);
+    VM_UNROOT(&vm, &symbol);
+    VM_UNROOT(&vm, &context);
+    vm_free(&vm);
+    return result;
+}
+
 static TestDefinition eval_context_tests[] = {
     DEFINE_UNIT_TEST(eval_context_symbol_manipulation, 7),
+    DEFINE_UNIT_TEST(eval_context_tracks_depth, 0),
+    DEFINE_UNIT_TEST(eval_context_allocates_env_lazily, 0),
 };
 
 TestList eval_context_test_list = (TestList) {
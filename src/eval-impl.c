@@ -8,7 +8,7 @@
 #include "sexpr.h"
 #include "vm.h"
 
-bool validate_function_def(EvalContext* context, SExpr* def) {
+bool validate_function_def(Vm* vm, EvalContext* context, SExpr* def) {
     // Function definitions are of the form ((args...) body).
     // Functions can have zero arguments.
 
@@ -33,7 +33,7 @@ bool validate_function_def(EvalContext* context, SExpr* def) {
     // Validate that the first of the two values is a list of symbols.
     SExpr* symbol_list = EXTRACT_CAR(def);
     if (!IS_CONS(symbol_list)) {
-        eval_context_invalid_type(context, 0, symbol_list, SEXPR_CONS);
+        eval_context_invalid_type(vm, context, 0, symbol_list, SEXPR_CONS);
         return false;
     }
 
@@ -42,6 +42,7 @@ bool validate_function_def(EvalContext* context, SExpr* def) {
     while (!IS_NIL(symbol_cons)) {
         if (!IS_SYMBOL(EXTRACT_CAR(symbol_cons))) {
             eval_context_invalid_arg_def_type(
+                vm,
                 context,
                 symbol_index,
                 EXTRACT_CAR(symbol_cons)
@@ -51,6 +52,7 @@ bool validate_function_def(EvalContext* context, SExpr* def) {
 
         if (!IS_CONS(EXTRACT_CDR(symbol_cons))) {
             eval_context_dotted_arg_list(
+                vm,
                 context,
                 symbol_index,
                 symbol_list
@@ -65,7 +67,7 @@ bool validate_function_def(EvalContext* context, SExpr* def) {
     return true;
 }
 
-bool validate_lambda_def(EvalContext* context, SExpr* lambda) {
+bool validate_lambda_def(Vm* vm, EvalContext* context, SExpr* lambda) {
     // Lambda definitions is of the form (lambda function_def).
 
     if (IS_NIL(lambda) || !IS_CONS(lambda)) {
@@ -76,11 +78,11 @@ bool validate_lambda_def(EvalContext* context, SExpr* lambda) {
         return false;
     }
 
-    if (!s8_equals(EXTRACT_SYMBOL(EXTRACT_CAR(lambda)), s8("lambda"))) {
+    if (EXTRACT_CAR(lambda) != vm->lambda_symbol) {
         return false;
     }
 
-    return validate_function_def(context, EXTRACT_CDR(lambda));
+    return validate_function_def(vm, context, EXTRACT_CDR(lambda));
 }
 
 size_t tab_count = 0;
@@ -88,6 +90,23 @@ void p() {
     for (size_t i = 0; i < tab_count; i++) { printf("\t"); }
 }
 
+static bool eval_func_call(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr* def,
+    SExpr* args,
+    SExpr** result,
+    SExpr** tail
+);
+static bool eval_closure_call(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* closure,
+    SExpr* args,
+    SExpr** result,
+    SExpr** tail
+);
 
 bool eval_internal(
     Vm* vm,
@@ -99,107 +118,175 @@ bool eval_internal(
 #ifdef DEBUG_LOG_EVAL
     p(); PRINT_SEXPR(sexpr); printf("\n"); tab_count++;
 #endif
-    VM_ROOT(vm, &context);
-    VM_ROOT(vm, &sexpr);
+    VM_FRAME_BEGIN(vm, &context, &sexpr);
 
+    // Forms in tail position are evaluated by this loop rather than
+    // recursively. The frames of the calls that led to them are the ones
+    // above `depth`, which calls in tail position replace.
+    size_t depth = eval_context_stack_depth(context);
     bool success = false;
-    if (IS_NIL(sexpr) || IS_NUMBER(sexpr) || IS_STRING(sexpr)) {
-        *result = sexpr;
-        success = true;
-        goto cleanup;
-    }
+    while (true) {
+        SExpr* tail = NULL;
+        bool self_evaluating = IS_NIL(sexpr)
+            || IS_NUMBER(sexpr)
+            || IS_STRING(sexpr)
+            || IS_CLOSURE(sexpr)
+            || IS_VECTOR(sexpr);
+        if (self_evaluating) {
+            *result = sexpr;
+            success = true;
+            goto cleanup;
+        }
+
+        if (IS_SYMBOL(sexpr)) {
+            if (!eval_context_lookup(vm, context, sexpr, result)) {
+                eval_context_symbol_lookup_failed(vm, context, sexpr);
+                goto cleanup;
+            }
 
-    if (IS_SYMBOL(sexpr)) {
-        if (!eval_context_lookup(vm, context, sexpr, result)) {
-            eval_context_symbol_lookup_failed(context, sexpr);
+            success = true;
             goto cleanup;
         }
 
-        success = true;
-        goto cleanup;
-    }
+        if (IS_CODE(sexpr)) {
+            success = vm_execute(vm, context, sexpr, result, &tail);
+            if (!success || tail == NULL) goto cleanup;
 
-    if (eval_context_stack_depth(context) >= 4096) {
-        eval_context_max_stack_depth_reached(context);
-        goto cleanup;
-    }
+            sexpr = tail;
+            eval_context_replace_callers(vm, context, depth);
+            continue;
+        }
 
-    if (IS_SYMBOL(EXTRACT_CAR(sexpr))) {
-        if (lookup_builtin(EXTRACT_SYMBOL(EXTRACT_CAR(sexpr)), NULL)) {
-            success = eval_func(
-                vm,
-                context,
-                EXTRACT_CAR(sexpr),
-                NIL,
-                EXTRACT_CDR(sexpr),
-                result
-            );
+        if (IS_LOCAL(sexpr)) {
+            if (!eval_context_lookup_local(vm, context, sexpr, result)) {
+                SExpr* symbol = AS_LOCAL(sexpr)->symbol;
+                eval_context_symbol_lookup_failed(vm, context, symbol);
+                goto cleanup;
+            }
+
+            success = true;
             goto cleanup;
         }
 
-        SExpr* function_def = NULL;
-        if (env_lookup(&vm->funcs, EXTRACT_CAR(sexpr), &function_def)) {
-            success = eval_func(
-                vm,
-                context,
-                EXTRACT_CAR(sexpr),
-                EXTRACT_CDR(EXTRACT_CDR(function_def)),
-                EXTRACT_CDR(sexpr),
-                result
-            );
+        if (!eval_context_check_depth(vm, context)) {
             goto cleanup;
         }
-    } else if (IS_CONS(EXTRACT_CAR(sexpr))) {
-        // Possible direct call of lambda expression.
-        if (validate_lambda_def(context, EXTRACT_CAR(sexpr))) {
-            success = eval_func(
-                vm,
-                context,
-                EXTRACT_CAR(sexpr),
-                EXTRACT_CDR(EXTRACT_CAR(sexpr)),
-                EXTRACT_CDR(sexpr),
-                result
-            );
+
+        SExpr* head = EXTRACT_CAR(sexpr);
+        SExpr* args = EXTRACT_CDR(sexpr);
+        bool called = false;
+        if (IS_SYMBOL(head)) {
+            SExpr* closure = NULL;
+            if (lookup_builtin(head) != NULL) {
+                called = true;
+                success =
+                    eval_func_call(vm, context, head, NIL, args, result, &tail);
+            } else if (env_table_lookup(vm->funcs, head, &closure)) {
+                called = true;
+                success = eval_closure_call(
+                    vm,
+                    context,
+                    closure,
+                    args,
+                    result,
+                    &tail
+                );
+            }
+        } else if (IS_CLOSURE(head)) {
+            // Left in place of a function's name by `funcall`.
+            called = true;
+            success = eval_closure_call(vm, context, head, args, result, &tail);
+        } else if (IS_CONS(head)) {
+            // Possible direct call of lambda expression.
+            if (validate_lambda_def(vm, context, head)) {
+                called = true;
+                success = eval_func_call(
+                    vm,
+                    context,
+                    head,
+                    EXTRACT_CDR(head),
+                    args,
+                    result,
+                    &tail
+                );
+            }
+        }
+
+        if (!called) {
+            eval_context_illegal_call(vm, context, sexpr);
             goto cleanup;
         }
-    }
 
-    eval_context_illegal_call(context, sexpr);
+        if (!success || tail == NULL) goto cleanup;
+
+        // A function's body replaces the frames that led to its call.
+        sexpr = tail;
+        eval_context_replace_callers(vm, context, depth);
+    }
 
 cleanup:
 #ifdef DEBUG_LOG_EVAL
     tab_count--; p(); PRINT_SEXPR(sexpr); printf(": "); PRINT_SEXPR(*result); printf("\n");
 #endif
-    VM_UNROOT(vm, &sexpr);
-    VM_UNROOT(vm, &context);
+    eval_context_pop_frames(vm, context, depth);
+
+    VM_FRAME_END(vm);
     return success;
 }
 
-bool eval_func(
+// Returns `true` if none of the elements of the argument list `args` are
+// calls or special forms.
+static bool atomic_args(SExpr* args) {
+    while (!IS_NIL(args) && IS_CONS(args)) {
+        SExpr* arg = EXTRACT_CAR(args);
+        if (!IS_NIL(arg) && IS_CONS(arg)) return false;
+
+        args = EXTRACT_CDR(args);
+    }
+
+    return true;
+}
+
+// Calls the function `id` with the unevaluated `args`.
+//
+// Builtins are found by name. Other functions bind their `arity` parameters
+// `params`, which must already be validated, and evaluate `body`.
+//
+// If `tail` isn't `NULL`, the form left in tail position by the call, such as
+// the function's body, is stored there instead of being evaluated. The call's
+// frame is then left for the caller to evaluate it in and pop.
+static bool eval_call(
     Vm* vm,
     EvalContext* context,
     SExpr* id,
-    SExpr* def,
+    SExpr* params,
+    size_t arity,
+    SExpr* body,
     SExpr* args,
-    SExpr** result
+    SExpr** result,
+    SExpr** tail
 ) {
-    VM_ROOT(vm, &context);
-    VM_ROOT(vm, &id);
-    VM_ROOT(vm, &def);
-    VM_ROOT(vm, &args);
-    
+    VM_FRAME_BEGIN(vm, &context, &id, &params, &body, &args);
+
     bool success = false;
+    bool tail_call = false;
 
-    // This function must only be called with a symbol for an `id` or a lambda
-    // expression for an `id`.
-    ASSERT(IS_SYMBOL(id) || (IS_CONS(id) && !IS_NIL(id)));
-    eval_context_push_frame(vm, context, id);
+    const BuiltinDef* builtin_def = IS_SYMBOL(id) ? lookup_builtin(id) : NULL;
+    bool builtin = builtin_def != NULL;
+
+    // Evaluating atoms can't bind variables or call functions, so a leaf
+    // builtin given only atoms runs without a frame. One is only pushed if
+    // the call fails, so that it still shows up in the backtrace.
+    bool framed = !builtin || !builtin_def->leaf || !atomic_args(args);
+    if (framed) {
+        eval_context_push_frame(vm, context, id, builtin ? NIL : params);
+    }
 
     size_t arg_count = 0;
     SExpr* arg = args;
     while (!IS_NIL(arg)) {
         if (!IS_CONS(arg)) {
-            eval_context_dotted_arg_list(context, arg_count, args);
+            eval_context_dotted_arg_list(vm, context, arg_count, args);
             goto cleanup;
         }
 
@@ -207,134 +294,137 @@ bool eval_func(
         arg = EXTRACT_CDR(arg);
     }
 
-    bool builtin;
-    bool eval_args;
-    bool variadic;
-    size_t var_count;
-
-    bool (*func)(
-        Vm* vm,
-        EvalContext* context,
-        size_t arg_count,
-        SExpr* args,
-        SExpr** result
-    );
-
-    // We only check for symbols and only to correctly handle builtin
-    // functions.
-    if (IS_SYMBOL(id)) {
-        BuiltinDef builtin_def;
-        if (lookup_builtin(EXTRACT_SYMBOL(id), &builtin_def)) {
-            builtin = true;
-            eval_args = builtin_def.eval_args;
-            variadic = builtin_def.variadic_args;
-            var_count = builtin_def.arg_count;
-            func = builtin_def.func;
-            goto prepare;
-        }
+    bool eval_args = builtin ? builtin_def->eval_args : true;
+    bool accepts = builtin
+        ? builtin_accepts(builtin_def, arg_count)
+        : arg_count == arity;
+    if (!accepts) {
+        size_t var_count = builtin ? builtin_def->arg_count : arity;
+        eval_context_erronous_arg_count(context, var_count);
+        goto cleanup;
     }
 
-    builtin = false;
-    eval_args = true;
-    variadic = false;
-    
-    var_count = 0;
-    SExpr* var = EXTRACT_CAR(def);
-    while (!IS_NIL(var)) {
-        if (!IS_CONS(var)) {
-            eval_context_dotted_arg_list(context, var_count, EXTRACT_CAR(var));
-            goto cleanup;
+    if (!eval_args) {
+        success = builtin_def->form_func(vm, context, arg_count, args, result);
+        if (success && builtin_def->tail) {
+            tail_call = tail != NULL;
+            if (tail_call) {
+                *tail = *result;
+            } else {
+                success = eval_internal(vm, context, *result, result);
+            }
         }
-
-        if (!IS_SYMBOL(EXTRACT_CAR(var))) {
-            eval_context_invalid_arg_def_type(
-                context,
-                var_count,
-                EXTRACT_CAR(var)
-            );
-            goto cleanup;
-        }   
-
-        var_count += 1;
-        var = EXTRACT_CDR(var);
-    }
-
-prepare:
-    if (var_count != arg_count && !variadic) {
-        eval_context_erronous_arg_count(context, var_count);
         goto cleanup;
     }
 
-    if (eval_args) {
-        SExpr* arg_cons = args;
-        VM_ROOT(vm, &arg_cons);
-        
-        SExpr* args_list = NIL;
-        SExpr* current = arg_cons;
-        VM_ROOT(vm, &args_list);
-        VM_ROOT(vm, &current);
-        
-        while (!IS_NIL(arg_cons)) {
-            SExpr* tmp = NULL;
-            if (!eval_internal(vm, context, EXTRACT_CAR(arg_cons), &tmp)) {
-                VM_UNROOT(vm, &current);
-                VM_UNROOT(vm, &args_list);
-                VM_UNROOT(vm, &arg_cons);
-                goto cleanup;
-            }
+    {
+        // The values are evaluated onto the value stack of the VM, followed by
+        // the arguments that are still to be evaluated.
+        GcFrame values_frame;
+        SExpr** values = vm_push_values(vm, &values_frame, arg_count + 1);
+        values[arg_count] = args;
+
+        success = true;
+        for (size_t i = 0; success && i < arg_count; i++) {
+            SExpr* form = EXTRACT_CAR(values[arg_count]);
+            success = eval_internal(vm, context, form, &values[i]);
+            values[arg_count] = EXTRACT_CDR(values[arg_count]);
+        }
 
-            SExpr* cons = vm_alloc_cons(vm, tmp, NIL);
-            if (args_list == NIL) {
-                args_list = cons;
-                current = args_list;
+        if (success && builtin) {
+            success = builtin_def->func(vm, context, arg_count, values, result);
+        } else if (success) {
+            eval_context_bind_locals(vm, context, values);
+            tail_call = tail != NULL;
+            if (tail_call) {
+                *tail = body;
             } else {
-                AS_CONS(current)->cdr = cons;
-                current = AS_CONS(current)->cdr;
+                success = eval_internal(vm, context, body, result);
             }
-
-            arg_cons = EXTRACT_CDR(arg_cons);
         }
 
-        args = args_list;
-
-        VM_UNROOT(vm, &current);
-        VM_UNROOT(vm, &args_list);
-        VM_UNROOT(vm, &arg_cons);
+        vm_pop_values(vm, &values_frame);
     }
 
-    if (!builtin) {
-        SExpr* def_iter = EXTRACT_CAR(def);
-        SExpr* value_iter = args;
+cleanup:
+    if (tail_call) {
+        // The frame now belongs to the caller.
+    } else if (framed) {
+        eval_context_pop_frame(vm, context);
+    } else if (!success) {
+        eval_context_push_frame(vm, context, id, NIL);
+    }
 
-        VM_ROOT(vm, &def_iter);
-        VM_ROOT(vm, &value_iter);
-        while (!IS_NIL(def_iter)) {
-            eval_context_add_symbol(
-                vm,
-                context,
-                EXTRACT_CAR(def_iter),
-                EXTRACT_CAR(value_iter)
-            );
+    VM_FRAME_END(vm);
+    return success;
+}
 
-            def_iter = EXTRACT_CDR(def_iter);
-            value_iter = EXTRACT_CDR(value_iter);
-        }
+static bool eval_func_call(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr* def,
+    SExpr* args,
+    SExpr** result,
+    SExpr** tail
+) {
+    // This function must only be called with a symbol for an `id` or a lambda
+    // expression for an `id`.
+    ASSERT(IS_SYMBOL(id) || (IS_CONS(id) && !IS_NIL(id)));
 
-        VM_UNROOT(vm, &def_iter);
-        VM_UNROOT(vm, &value_iter);
+    if (IS_NIL(def)) {
+        return eval_call(vm, context, id, NIL, 0, NIL, args, result, tail);
+    }
 
-        success =
-            eval_internal(vm, context, EXTRACT_CAR(EXTRACT_CDR(def)), result);
-    } else {
-        success = func(vm, context, arg_count, args, result);
+    SExpr* params = EXTRACT_CAR(def);
+    size_t arity = 0;
+    for (SExpr* param = params; !IS_NIL(param); param = EXTRACT_CDR(param)) {
+        arity += 1;
     }
 
-cleanup:
-    eval_context_pop_frame(context);
+    SExpr* body = EXTRACT_CAR(EXTRACT_CDR(def));
+    return eval_call(vm, context, id, params, arity, body, args, result, tail);
+}
 
-    VM_UNROOT(vm, &args);
-    VM_UNROOT(vm, &def);
-    VM_UNROOT(vm, &id);
-    VM_UNROOT(vm, &context);
-    return success;
+static bool eval_closure_call(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* closure,
+    SExpr* args,
+    SExpr** result,
+    SExpr** tail
+) {
+    SExprClosure* fields = AS_CLOSURE(closure);
+    return eval_call(
+        vm,
+        context,
+        fields->id,
+        fields->params,
+        fields->arity,
+        fields->body,
+        args,
+        result,
+        tail
+    );
+}
+
+bool eval_func(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr* def,
+    SExpr* args,
+    SExpr** result
+) {
+    return eval_func_call(vm, context, id, def, args, result, NULL);
+}
+
+bool eval_closure(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* closure,
+    SExpr* args,
+    SExpr** result
+) {
+    return eval_closure_call(vm, context, closure, args, result, NULL);
 }
@@ -1,5 +1,7 @@
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "builtin.h"
 #include "common.h"
@@ -9,16 +11,49 @@
 #include "sexpr.h"
 #include "vm.h"
 
+// Evaluates `sexpr`, reporting an error in `*context` if the heap limit is
+// reached.
+//
+// `context` must be rooted by the caller, since the collector updates it
+// behind the back of `setjmp`.
+static bool eval_guarded(
+    Vm* vm,
+    EvalContext** context,
+    SExpr* sexpr,
+    SExpr** result
+) {
+    jmp_buf* previous_handler = vm->gc.oom_handler;
+    size_t root_count = vm->gc.root_count;
+    GcFrame* frames = vm->gc.frames;
+    size_t value_count = vm_value_count(vm);
+
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        // Drop the roots of the frames that were unwound.
+        vm->gc.root_count = root_count;
+        vm->gc.frames = frames;
+        vm_truncate_values(vm, value_count);
+        vm->gc.oom_handler = previous_handler;
+
+        eval_context_out_of_memory(*context);
+        return false;
+    }
+
+    vm->gc.oom_handler = &handler;
+    bool success = eval_internal(vm, *context, sexpr, result);
+    vm->gc.oom_handler = previous_handler;
+
+    return success;
+}
+
 EvalResult eval(Vm* vm, SExpr* sexpr) {
     SExpr* result = NULL;
     EvalContext* context = NULL;
 
-    VM_ROOT(vm, &sexpr);
-    VM_ROOT(vm, &result);
-    VM_ROOT(vm, &context);
+    VM_FRAME_BEGIN(vm, &sexpr, &result, &context);
 
     context = eval_context_alloc(vm);
-    eval_internal(vm, context, sexpr, &result);
+    eval_guarded(vm, &context, sexpr, &result);
 
     EvalResult eval_result;
     if (eval_context_is_ok(context)) {
@@ -29,20 +64,269 @@ EvalResult eval(Vm* vm, SExpr* sexpr) {
         eval_result.as.err = context;
     }
 
-    VM_UNROOT(vm, &result);
-    VM_UNROOT(vm, &context);
-    VM_UNROOT(vm, &sexpr);
+    VM_FRAME_END(vm);
     return eval_result;
 }
 
 
 #ifdef ENABLE_TESTS
 
+#include "parser.h"
 #include "test.h"
 #include "util.h"
 
-TestDefinition eval_tests[] = {
+EvalResult eval_test_result(Vm* vm, s8 input) {
+    Parser parser;
+    parser_init_s8(&parser, input);
+
+    EvalResult result = { .ok = true, .as.ok = NIL };
+    ParseResult parsed;
+    while (result.ok && parser_next_sexpr(vm, &parser, &parsed)) {
+        ASSERT(parsed.ok, "test input must parse");
+        result = eval(vm, parsed.as.ok);
+    }
+    parser_free(&parser);
+
+    return result;
+}
+
+SExpr* eval_test_run(Vm* vm, s8 input) {
+    EvalResult result = eval_test_result(vm, input);
+    return result.ok ? result.as.ok : NIL;
+}
+
+bool eval_test_number(Vm* vm, s8 input, double expected) {
+    SExpr* value = eval_test_run(vm, input);
+    return IS_NUMBER(value) && EXTRACT_NUMBER(value) == expected;
+}
+
+bool eval_test_fails_with(
+    Vm* vm,
+    s8 input,
+    EvalErrorType error,
+    size_t arg_index
+) {
+    EvalResult result = eval_test_result(vm, input);
+    return !result.ok
+        && eval_context_error(result.as.err) == error
+        && eval_context_arg_index(result.as.err) == arg_index;
+}
+
+bool eval_functions_are_closures() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+    SExpr* value = NULL;
+    VM_ROOT(&vm, &value);
+
+    value = eval_test_run(&vm, s8("(lambda (a b) (+ a b))"));
+    if (!IS_CLOSURE(value) || AS_CLOSURE(value)->arity != 2) goto cleanup;
+
+    value = eval_test_run(&vm, s8(
+        "(define twice (f x) (funcall f (funcall f x)))"
+        "(define inc (x) (+ x 1))"
+        "(function inc)"
+    ));
+    if (!IS_CLOSURE(value) || AS_CLOSURE(value)->arity != 1) goto cleanup;
+
+    // Defined functions, lambdas and builtins can all be passed around.
+    s8 input = s8("(twice (function inc) 1)");
+    if (!eval_test_number(&vm, input, 3)) goto cleanup;
+
+    input = s8("(twice (lambda (x) (* x 3)) 1)");
+    if (!eval_test_number(&vm, input, 9)) goto cleanup;
+
+    value = eval_test_run(&vm, s8(
+        "(define pair (f) (funcall f 1 2))"
+        "(pair (function cons))"
+    ));
+    if (IS_NIL(value) || !IS_CONS(value)) goto cleanup;
+    if (EXTRACT_NUMBER(EXTRACT_CDR(value)) != 2) goto cleanup;
+
+    // Closures aren't lists.
+    value = eval_test_run(&vm, s8("(list? (function inc))"));
+    if (!IS_NIL(value)) goto cleanup;
+
+    result = true;
+cleanup:
+    VM_UNROOT(&vm, &value);
+    vm_free(&vm);
+    return result;
+}
+
+bool eval_arithmetic_is_variadic() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    if (!eval_test_number(&vm, s8("(+ 1 2 3 4)"), 10)) goto cleanup;
+    if (!eval_test_number(&vm, s8("(*)"), 1)) goto cleanup;
+    if (!eval_test_number(&vm, s8("(/ 60 2 3)"), 10)) goto cleanup;
+
+    // A single argument is negated or inverted.
+    if (!eval_test_number(&vm, s8("(- 4)"), -4)) goto cleanup;
+    if (!eval_test_number(&vm, s8("(/ 4)"), 0.25)) goto cleanup;
+
+    // Comparisons hold between each argument and the next.
+    if (eval_test_run(&vm, s8("(< 1 2 3)")) != vm.t_symbol) goto cleanup;
+    EvalResult ordered = eval_test_result(&vm, s8("(<= 1 3 3 2)"));
+    if (!ordered.ok || !IS_NIL(ordered.as.ok)) goto cleanup;
+
+    // Compiled code calls the builtin for anything but two arguments.
+    s8 input = s8(
+        "(define spread (a b c) (if (< a b c) (- c b a) (- a)))"
+        "(spread 1 2 4)"
+    );
+    if (!eval_test_number(&vm, input, 1)) goto cleanup;
+    if (!eval_test_number(&vm, s8("(spread 3 2 1)"), -3)) goto cleanup;
 
+    input = s8("(-)");
+    if (!eval_test_fails_with(&vm, input, ERRONOUS_ARG_COUNT, 1)) goto cleanup;
+
+    // A comparison still needs something to compare with.
+    input = s8("(< 1)");
+    if (!eval_test_fails_with(&vm, input, ERRONOUS_ARG_COUNT, 2)) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool eval_vectors_are_indexed() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    SExpr* value = eval_test_run(&vm, s8(
+        "(let v (list->vector '(1 2 3)))"
+        "(vector-set! v 1 'b)"
+        "v"
+    ));
+    if (!IS_VECTOR(value) || AS_VECTOR(value)->len != 3) goto cleanup;
+    if (EXTRACT_NUMBER(AS_VECTOR(value)->items[2]) != 3) goto cleanup;
+    if (AS_VECTOR(value)->items[1] != vm_find_symbol(&vm, s8("b"))) {
+        goto cleanup;
+    }
+
+    // Vectors too large for the nursery keep the values stored in them alive.
+    s8 input = s8(
+        "(define fill (v i n)"
+        "  (if (lt i n) (begin (vector-set! v i (cons i i)) (fill v (+ i 1) n))"
+        "      v))"
+        "(let big (fill (make-vector 4096) 0 4096))"
+        "(car (vector-ref big 4095))"
+    );
+    if (!eval_test_number(&vm, input, 4095)) goto cleanup;
+    if (!eval_test_number(&vm, s8("(vector-length big)"), 4096)) goto cleanup;
+
+    // Indices must be whole numbers within the vector.
+    input = s8("(vector-ref v 3)");
+    if (!eval_test_fails_with(&vm, input, INDEX_OUT_OF_RANGE, 1)) goto cleanup;
+
+    input = s8("(vector-ref v 0.5)");
+    if (!eval_test_fails_with(&vm, input, INDEX_OUT_OF_RANGE, 1)) goto cleanup;
+
+    input = s8("(make-vector -1)");
+    if (!eval_test_fails_with(&vm, input, INDEX_OUT_OF_RANGE, 0)) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool eval_stops_before_native_stack_overflow() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    // The frame count alone would let this recurse until the process
+    // crashes.
+    vm.max_stack_depth = SIZE_MAX;
+    vm.native_stack_limit = 256 * 1024;
+
+    s8 input = s8(
+        "(define rec (n) (if (< n 1) 0 (+ 1 (rec (- n 1)))))"
+        "(rec 10)"
+    );
+    if (!eval_test_number(&vm, input, 10)) goto cleanup;
+    input = s8("(rec 1000000)");
+    if (!eval_test_fails_with(&vm, input, MAX_STACK_DEPTH_REACHED, 0)) {
+        goto cleanup;
+    }
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+// Evaluates `(+ 1 (+ 1 1 ...) 1)`, where the inner call has `arg_count`
+// arguments.
+static bool eval_test_many_arguments(Vm* vm, size_t arg_count) {
+    s8 prefix = s8("(+ 1 (+");
+    s8 suffix = s8(") 1)");
+    size_t len = prefix.len + 2 * arg_count + suffix.len;
+    uint8_t* ptr = (uint8_t*) malloc(len);
+    if (ptr == NULL) return false;
+
+    memcpy(ptr, prefix.ptr, prefix.len);
+    for (size_t i = 0; i < arg_count; i++) {
+        ptr[prefix.len + 2 * i] = ' ';
+        ptr[prefix.len + 2 * i + 1] = '1';
+    }
+    memcpy(ptr + len - suffix.len, suffix.ptr, suffix.len);
+
+    s8 input = { ptr, len };
+    bool result = eval_test_number(vm, input, (double) arg_count + 2);
+    free(ptr);
+    return result;
+}
+
+bool eval_calls_take_many_arguments() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    // The inner call takes more values than a chunk of the value stack holds,
+    // while the outer call keeps its own values.
+    if (!eval_test_many_arguments(&vm, 4 * VM_VALUE_CHUNK_SIZE)) goto cleanup;
+    if (vm_value_count(&vm) != 0) goto cleanup;
+
+    // Arguments that wouldn't fit on the native stack. Collecting on every
+    // allocation would take too long with this many.
+    vm.gc.stress_paused = true;
+    if (!eval_test_many_arguments(&vm, 1000000)) goto cleanup;
+    if (vm_value_count(&vm) != 0) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+TestDefinition eval_tests[] = {
+    DEFINE_UNIT_TEST(eval_arithmetic_is_variadic, 0),
+    DEFINE_UNIT_TEST(eval_calls_take_many_arguments, 0),
+    DEFINE_UNIT_TEST(eval_functions_are_closures, 0),
+    DEFINE_UNIT_TEST(eval_stops_before_native_stack_overflow, 0),
+    DEFINE_UNIT_TEST(eval_vectors_are_indexed, 0),
 };
 
 TestList eval_test_list = (TestList) {
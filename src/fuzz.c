@@ -21,7 +21,7 @@ int main() {
         Vm vm;
         Parser parser;
 
-        if (!vm_init(&vm)) {
+        if (!vm_init(&vm, NULL)) {
             fprintf(stderr, "failed to initialize VM\n");
             return EXIT_FAILURE;
         }
@@ -0,0 +1,329 @@
+// Required for `sched_yield`.
+#define _POSIX_C_SOURCE 200112L
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "gc-workers.h"
+#include "util.h"
+
+struct GcWorkerThread {
+    pthread_t thread;
+    GcWorkers* workers;
+    size_t index;
+};
+
+static void gc_work_queue_init(GcWorkQueue* queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    queue->items = NULL;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->capacity = 0;
+}
+
+static void gc_work_queue_free(GcWorkQueue* queue) {
+    pthread_mutex_destroy(&queue->lock);
+    free(queue->items);
+    queue->items = NULL;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->capacity = 0;
+}
+
+static void gc_work_queue_push(GcWorkQueue* queue, void* item) {
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail >= queue->capacity) {
+        // Reuse the space freed by stolen items before growing.
+        if (queue->head != 0) {
+            size_t count = queue->tail - queue->head;
+            memmove(
+                queue->items,
+                &queue->items[queue->head],
+                count * sizeof(void*)
+            );
+            queue->head = 0;
+            queue->tail = count;
+        } else {
+            bool success =
+                GROW(&queue->items, &queue->capacity, sizeof(void*), 256);
+            if (!success) {
+                fprintf(stderr, "growing gc work queue failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
+    queue->items[queue->tail] = item;
+    queue->tail += 1;
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static void* gc_work_queue_pop(GcWorkQueue* queue) {
+    void* item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head != queue->tail) {
+        queue->tail -= 1;
+        item = queue->items[queue->tail];
+        if (queue->head == queue->tail) {
+            queue->head = 0;
+            queue->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+static void* gc_work_queue_steal(GcWorkQueue* queue) {
+    void* item = NULL;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head != queue->tail) {
+        item = queue->items[queue->head];
+        queue->head += 1;
+        if (queue->head == queue->tail) {
+            queue->head = 0;
+            queue->tail = 0;
+        }
+    }
+    pthread_mutex_unlock(&queue->lock);
+
+    return item;
+}
+
+static bool gc_work_queue_is_empty(GcWorkQueue* queue) {
+    pthread_mutex_lock(&queue->lock);
+    bool empty = queue->head == queue->tail;
+    pthread_mutex_unlock(&queue->lock);
+
+    return empty;
+}
+
+static void* gc_worker_main(void* arg) {
+    GcWorkerThread* thread = (GcWorkerThread*) arg;
+    GcWorkers* workers = thread->workers;
+    size_t generation = 0;
+
+    pthread_mutex_lock(&workers->lock);
+    while (true) {
+        while (!workers->shutdown && workers->generation == generation) {
+            pthread_cond_wait(&workers->start, &workers->lock);
+        }
+
+        if (workers->shutdown) break;
+
+        generation = workers->generation;
+        GcWorkerTask task = workers->task;
+        void* context = workers->context;
+        pthread_mutex_unlock(&workers->lock);
+
+        task(workers, thread->index, context);
+
+        pthread_mutex_lock(&workers->lock);
+        workers->running -= 1;
+        if (workers->running == 0) {
+            pthread_cond_signal(&workers->finish);
+        }
+    }
+    pthread_mutex_unlock(&workers->lock);
+
+    return NULL;
+}
+
+// Stops and joins the first `count` threads of the pool.
+static void gc_workers_stop(GcWorkers* workers, size_t count) {
+    pthread_mutex_lock(&workers->lock);
+    workers->shutdown = true;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    for (size_t i = 0; i < count; i++) {
+        pthread_join(workers->threads[i].thread, NULL);
+    }
+}
+
+bool gc_workers_init(GcWorkers* workers, size_t count) {
+    ASSERT(count != 0);
+
+    workers->count = count;
+    workers->generation = 0;
+    workers->running = 0;
+    workers->shutdown = false;
+    workers->task = NULL;
+    workers->context = NULL;
+    workers->idle = 0;
+
+    workers->queues = (GcWorkQueue*) malloc(count * sizeof(GcWorkQueue));
+    workers->threads =
+        (GcWorkerThread*) malloc((count - 1) * sizeof(GcWorkerThread));
+    if (workers->queues == NULL || (count > 1 && workers->threads == NULL)) {
+        free(workers->queues);
+        free(workers->threads);
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        gc_work_queue_init(&workers->queues[i]);
+    }
+
+    pthread_mutex_init(&workers->lock, NULL);
+    pthread_cond_init(&workers->start, NULL);
+    pthread_cond_init(&workers->finish, NULL);
+
+    // The calling thread acts as worker zero.
+    for (size_t i = 0; i < count - 1; i++) {
+        GcWorkerThread* thread = &workers->threads[i];
+        thread->workers = workers;
+        thread->index = i + 1;
+
+        if (pthread_create(&thread->thread, NULL, gc_worker_main, thread)) {
+            gc_workers_stop(workers, i);
+            gc_workers_free(workers);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void gc_workers_free(GcWorkers* workers) {
+    if (!workers->shutdown) {
+        gc_workers_stop(workers, workers->count - 1);
+    }
+
+    for (size_t i = 0; i < workers->count; i++) {
+        gc_work_queue_free(&workers->queues[i]);
+    }
+
+    pthread_mutex_destroy(&workers->lock);
+    pthread_cond_destroy(&workers->start);
+    pthread_cond_destroy(&workers->finish);
+
+    free(workers->queues);
+    free(workers->threads);
+    workers->queues = NULL;
+    workers->threads = NULL;
+    workers->count = 0;
+}
+
+void gc_workers_run(GcWorkers* workers, GcWorkerTask task, void* context) {
+    pthread_mutex_lock(&workers->lock);
+    workers->task = task;
+    workers->context = context;
+    workers->idle = 0;
+    workers->running = workers->count - 1;
+    workers->generation += 1;
+    pthread_cond_broadcast(&workers->start);
+    pthread_mutex_unlock(&workers->lock);
+
+    task(workers, 0, context);
+
+    pthread_mutex_lock(&workers->lock);
+    while (workers->running != 0) {
+        pthread_cond_wait(&workers->finish, &workers->lock);
+    }
+    pthread_mutex_unlock(&workers->lock);
+}
+
+void gc_workers_push(GcWorkers* workers, size_t index, void* item) {
+    gc_work_queue_push(&workers->queues[index], item);
+}
+
+static bool gc_workers_have_work(GcWorkers* workers) {
+    for (size_t i = 0; i < workers->count; i++) {
+        if (!gc_work_queue_is_empty(&workers->queues[i])) return true;
+    }
+
+    return false;
+}
+
+void* gc_workers_take(GcWorkers* workers, size_t index) {
+    while (true) {
+        void* item = gc_work_queue_pop(&workers->queues[index]);
+        if (item != NULL) return item;
+
+        for (size_t i = 1; i < workers->count; i++) {
+            size_t victim = (index + i) % workers->count;
+            item = gc_work_queue_steal(&workers->queues[victim]);
+            if (item != NULL) return item;
+        }
+
+        // Only workers with work can push more, so once every worker has
+        // found every queue empty, the work is done.
+        __atomic_add_fetch(&workers->idle, 1, __ATOMIC_SEQ_CST);
+        while (true) {
+            size_t idle = __atomic_load_n(&workers->idle, __ATOMIC_SEQ_CST);
+            if (idle == workers->count) return NULL;
+            if (gc_workers_have_work(workers)) break;
+
+            sched_yield();
+        }
+        __atomic_sub_fetch(&workers->idle, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+#ifdef ENABLE_TESTS
+
+#include "test.h"
+
+typedef struct {
+    size_t depth;
+    size_t processed;
+} GcWorkersTestContext;
+
+// Items encode a depth, offset by one so that they are never `NULL`. Each item
+// above depth zero pushes two items of the next depth.
+static void gc_workers_test_task(
+    GcWorkers* workers,
+    size_t index,
+    void* context
+) {
+    GcWorkersTestContext* test = (GcWorkersTestContext*) context;
+    if (index == 0) {
+        gc_workers_push(workers, 0, (void*) (uintptr_t) (test->depth + 1));
+    }
+
+    void* item;
+    while ((item = gc_workers_take(workers, index)) != NULL) {
+        size_t depth = (size_t) (uintptr_t) item - 1;
+        __atomic_add_fetch(&test->processed, 1, __ATOMIC_SEQ_CST);
+
+        if (depth == 0) continue;
+        gc_workers_push(workers, index, (void*) (uintptr_t) depth);
+        gc_workers_push(workers, index, (void*) (uintptr_t) depth);
+    }
+}
+
+bool gc_workers_process_every_item() {
+    GcWorkers workers;
+    if (!gc_workers_init(&workers, 4)) {
+        return false;
+    }
+
+    bool result = true;
+    for (size_t run = 0; run < 8; run++) {
+        GcWorkersTestContext test = { 12, 0 };
+        gc_workers_run(&workers, gc_workers_test_task, &test);
+
+        result = result && test.processed == ((size_t) 1 << 13) - 1;
+    }
+
+    gc_workers_free(&workers);
+    return result;
+}
+
+TestDefinition gc_workers_tests[] = {
+    DEFINE_UNIT_TEST(gc_workers_process_every_item, 0),
+};
+
+TestList gc_workers_test_list = (TestList) {
+    gc_workers_tests,
+    countof(gc_workers_tests)
+};
+
+#endif
@@ -1,62 +1,367 @@
+// Required for `clock_gettime`.
+#define _POSIX_C_SOURCE 199309L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "arena.h"
 #include "common.h"
 #include "gc.h"
 #include "util.h"
 
-#define INITIAL_REGION_SIZE 4096
+#define NURSERY_SIZE (32 * 1024)
+
+// The address space reserved for each semispace, so that it can usually be
+// resized in place.
+#if SIZE_MAX > UINT32_MAX
+#define SEMISPACE_RESERVE ((size_t) 4 * 1024 * 1024 * 1024)
+#else
+#define SEMISPACE_RESERVE ((size_t) 256 * 1024 * 1024)
+#endif
+
+// Allocations larger than this are placed directly into the old generation,
+// since copying them out of the nursery would cost more than it saves.
+#define NURSERY_MAX_OBJECT_SIZE (NURSERY_SIZE / 4)
+
+// Typed objects larger than this are allocated in the large object space
+// rather than the old generation.
+#define GC_LARGE_OBJECT_SIZE NURSERY_MAX_OBJECT_SIZE
+
+// The size of the to-space buffers claimed by parallel collection threads.
+//
+// Every copied object, along with its alignment padding, fits into a quarter
+// of a buffer, so a buffer is at least three quarters full when it's retired.
+#define GC_LAB_SIZE (4 * GC_LARGE_OBJECT_SIZE)
+
+// Set in the header of an object that has been copied, in which case the rest
+// of the header is the address of the copy.
+#define GC_FORWARDED ((size_t) 1)
+// Set in the header of an old object once it has been added to the remembered
+// set.
+#define GC_FLAG_REMEMBERED ((size_t) 1 << (sizeof(size_t) * 8 - 1))
+// Set in the header of objects in the large object space.
+#define GC_FLAG_LARGE ((size_t) 1 << (sizeof(size_t) * 8 - 2))
+// Set in the header of large objects reached by a full collection.
+#define GC_FLAG_MARKED ((size_t) 1 << (sizeof(size_t) * 8 - 3))
+#define GC_FLAG_MASK (GC_FLAG_REMEMBERED | GC_FLAG_LARGE | GC_FLAG_MARKED)
+
+// The type id is stored above the forwarding bit.
+#define GC_TYPE_SHIFT 1
+
+// Marks a word of alignment padding in to-space so that it can be skipped
+// when walking over the copied objects.
+#define GC_PADDING SIZE_MAX
+
+// Precedes every object in the large object space.
+struct GcLargeObject {
+    GcLargeObject* next;
+    // The next marked object that still has to be scanned.
+    GcLargeObject* next_gray;
+    // The block returned by `malloc`, which the object is aligned within.
+    void* block;
+    // The size of the block, which is what the object costs the heap.
+    size_t size;
+};
+
+// The state of a thread taking part in a parallel collection.
+typedef struct {
+    size_t index;
+    // The unused part of the thread's to-space buffer.
+    uint8_t* next;
+    uint8_t* end;
+    // Where the most recent allocation began, including its padding.
+    uint8_t* last;
+} GcCopyThread;
+
+// Set while the current thread is copying objects for a parallel collection.
+static __thread GcCopyThread* gc_copy_thread = NULL;
+
+static GcObject* gc_copy_object(Gc* gc, GcObject* object);
+
+// Rounds object sizes up so that every object in to-space begins on a word
+// boundary.
+static size_t gc_round_size(size_t size) {
+    return (size + alignof(GcObject) - 1) & ~(alignof(GcObject) - 1);
+}
+
+// Returns the worst-case padding required to place an object with the given
+// alignment, beyond the padding required by any object.
+static size_t gc_align_slack(size_t align) {
+    return align - alignof(GcObject);
+}
+
+static size_t gc_header_type(size_t header) {
+    return (header & ~GC_FLAG_MASK) >> GC_TYPE_SHIFT;
+}
 
 size_t gc_object_type(GcObject* object) {
-    return object->flags;
+    return gc_header_type(object->header);
+}
+
+// Returns the copy of the object with the given header, or `NULL` if it hasn't
+// been forwarded.
+static GcObject* gc_forwarded(size_t header) {
+    if ((header & GC_FORWARDED) == 0) return NULL;
+    return (GcObject*) (header & ~GC_FORWARDED);
+}
+
+void gc_config_default(GcConfig* config) {
+    config->initial_size = 256 * 1024;
+    config->growth_factor = 2.0;
+    config->target_live_ratio = 0.5;
+    config->shrink_after = 4;
+    config->max_heap_size = 0;
+    config->huge_pages = false;
+    config->threads = 1;
+}
+
+bool gc_config_is_valid(const GcConfig* config) {
+    if (config->initial_size == 0) return false;
+    if (!(config->growth_factor > 1.0)) return false;
+    if (!(config->target_live_ratio > 0.0)) return false;
+    if (!(config->target_live_ratio <= 1.0)) return false;
+    if (config->threads == 0) return false;
+
+    if (config->max_heap_size == 0) return true;
+
+    // The heap must be able to hold the nursery and both initial semispaces.
+    if (config->max_heap_size < NURSERY_SIZE) return false;
+    return config->initial_size <= (config->max_heap_size - NURSERY_SIZE) / 2;
+}
+
+static uint64_t gc_now_ns(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+}
+
+static void gc_record_pause(Gc* gc, uint64_t start) {
+    uint64_t pause = gc_now_ns() - start;
+    gc->stats.total_pause_ns += pause;
+    if (pause > gc->stats.max_pause_ns) gc->stats.max_pause_ns = pause;
+
+    size_t bucket = 0;
+    uint64_t micros = pause / 1000;
+    while (micros > 1 && bucket < GC_PAUSE_BUCKET_COUNT - 1) {
+        micros >>= 1;
+        bucket += 1;
+    }
+    gc->stats.pause_histogram[bucket] += 1;
+}
+
+static void gc_update_heap_size(Gc* gc) {
+    gc->stats.large_object_size = gc->large_size;
+    gc->stats.heap_size =
+        arena_capacity(&gc->active)
+        + arena_capacity(&gc->inactive)
+        + arena_capacity(&gc->nursery)
+        + gc->large_size;
+    if (gc->stats.heap_size > gc->stats.peak_heap_size) {
+        gc->stats.peak_heap_size = gc->stats.heap_size;
+    }
+}
+
+// Accounts for an object that was copied into the old generation.
+static void gc_record_survivor(Gc* gc, GcObject* object, size_t size) {
+    size_t align = gc->types[gc_object_type(object)].align;
+    if (align > alignof(GcObject)) gc->old_slack += gc_align_slack(align);
+
+    gc->stats.survivors[gc_object_type(object)] += 1;
+    gc->stats.bytes_copied += size;
+}
+
+static bool gc_arena_init(Gc* gc, Arena* arena, size_t capacity) {
+    size_t reserve = gc->max_semispace_size < SEMISPACE_RESERVE
+        ? gc->max_semispace_size
+        : SEMISPACE_RESERVE;
+    if (!arena_init_reserved(arena, capacity, reserve)) return false;
+
+    if (gc->config.huge_pages) arena_advise_huge_pages(arena);
+    return true;
 }
 
-bool gc_init(Gc* gc) {
+bool gc_init(Gc* gc, const GcConfig* config) {
+    GcConfig default_config;
+    if (config == NULL) {
+        gc_config_default(&default_config);
+        config = &default_config;
+    }
+
+    if (!gc_config_is_valid(config)) {
+        return false;
+    }
+
+    gc->config = *config;
+    gc->max_semispace_size = SIZE_MAX / 2;
+    if (config->max_heap_size != 0) {
+        gc->max_semispace_size = (config->max_heap_size - NURSERY_SIZE) / 2;
+    }
+    gc->underused_count = 0;
+    gc->oom_handler = NULL;
+
+    memset(&gc->stats, 0, sizeof(GcStats));
+
     gc->collecting = false;
-    if (!arena_init(&gc->active, INITIAL_REGION_SIZE)) {
+    gc->minor = false;
+    if (!gc_arena_init(gc, &gc->active, config->initial_size)) {
+        return false;
+    }
+
+    if (!gc_arena_init(gc, &gc->inactive, config->initial_size)) {
+        arena_free(&gc->active);
+        return false;
+    }
+
+    if (!arena_init(&gc->nursery, NURSERY_SIZE)) {
+        arena_free(&gc->inactive);
+        arena_free(&gc->active);
         return false;
     }
 
-    if (!arena_init(&gc->inactive, INITIAL_REGION_SIZE)) {
+    if (!gc_workers_init(&gc->workers, config->threads)) {
+        arena_free(&gc->nursery);
+        arena_free(&gc->inactive);
         arena_free(&gc->active);
         return false;
     }
+    pthread_mutex_init(&gc->to_space_lock, NULL);
+
+    gc->log_forwarding = false;
+    gc->forwarded = NULL;
+    gc->forwarded_count = 0;
+    gc->forwarded_capacity = 0;
+    gc->nursery_slack = 0;
+    gc->old_slack = 0;
+
+    gc->large_objects = NULL;
+    gc->gray_objects = NULL;
+    gc->large_size = 0;
+    gc->large_limit = config->initial_size;
+
+    gc->remembered = NULL;
+    gc->remembered_count = 0;
+    gc->remembered_capacity = 0;
 
     gc->roots = NULL;
     gc->root_count = 0;
     gc->root_capacity = 0;
 
+    gc->frames = NULL;
+
     gc->types = NULL;
     gc->type_count = 0;
     gc->type_capacity = 0;
 
+#ifdef DEBUG_STRESS_GC
+    gc->stress_count = 0;
+    gc->stress_paused = false;
+#endif
+
+    gc_update_heap_size(gc);
+
     return true;
 }
 
 void gc_free(Gc* gc) {
     gc->collecting = false;
+    gc->minor = false;
 
     arena_free(&gc->active);
     arena_free(&gc->inactive);
+    arena_free(&gc->nursery);
+
+    gc_workers_free(&gc->workers);
+    pthread_mutex_destroy(&gc->to_space_lock);
+
+    free(gc->forwarded);
+    gc->forwarded = NULL;
+    gc->forwarded_count = 0;
+    gc->forwarded_capacity = 0;
+
+    GcLargeObject* large = gc->large_objects;
+    while (large != NULL) {
+        GcLargeObject* next = large->next;
+        free(large->block);
+        large = next;
+    }
+    gc->large_objects = NULL;
+    gc->gray_objects = NULL;
+    gc->large_size = 0;
+
+    free(gc->remembered);
+    gc->remembered = NULL;
+    gc->remembered_count = 0;
+    gc->remembered_capacity = 0;
 
     free(gc->roots);
     gc->roots = NULL;
     gc->root_count = 0;
     gc->root_capacity = 0;
 
+    gc->frames = NULL;
+
     free(gc->types);
     gc->types = NULL;
     gc->type_count = 0;
     gc->type_capacity = 0;
 }
 
+void gc_print_stats(Gc* gc, FILE* file) {
+    GcStats* stats = &gc->stats;
+    size_t collections = stats->minor_collections + stats->major_collections;
+
+    fprintf(file, "gc statistics:\n");
+    fprintf(file, "  minor collections: %zu\n", stats->minor_collections);
+    fprintf(file, "  major collections: %zu\n", stats->major_collections);
+    fprintf(file, "  bytes allocated: %zu\n", stats->bytes_allocated);
+    fprintf(file, "  bytes copied: %zu\n", stats->bytes_copied);
+    fprintf(file, "  heap size: %zu\n", stats->heap_size);
+    fprintf(file, "  peak heap size: %zu\n", stats->peak_heap_size);
+    fprintf(file, "  large object size: %zu\n", stats->large_object_size);
+
+    fprintf(file, "  survivors by type:\n");
+    for (size_t type_id = 0; type_id < gc->type_count; type_id++) {
+        fprintf(file, "    %zu: %zu\n", type_id, stats->survivors[type_id]);
+    }
+
+    fprintf(
+        file,
+        "  total pause: %.3f ms\n",
+        (double) stats->total_pause_ns / 1e6
+    );
+    fprintf(
+        file,
+        "  mean pause: %.3f us\n",
+        collections == 0
+        ? 0.0
+        : (double) stats->total_pause_ns / 1e3 / (double) collections
+    );
+    fprintf(
+        file,
+        "  max pause: %.3f us\n",
+        (double) stats->max_pause_ns / 1e3
+    );
+
+    fprintf(file, "  pause histogram:\n");
+    for (size_t i = 0; i < GC_PAUSE_BUCKET_COUNT; i++) {
+        if (stats->pause_histogram[i] == 0) continue;
+
+        fprintf(
+            file,
+            "    < %zu us: %zu\n",
+            (size_t) 1 << (i + 1),
+            stats->pause_histogram[i]
+        );
+    }
+}
+
 size_t gc_add_type(
     Gc* gc,
     size_t align,
     GcObjectSize object_size,
-    GcCopyObject copy_object,
-    GcGetChildren get_children
+    GcScanObject scan_object
 ) {
     size_t type_id = gc->type_count;
 #ifdef DEBUG_LOG_GC
@@ -69,11 +374,15 @@ size_t gc_add_type(
         }
     }
 
+    // Every type keeps its survivor count in the fixed-size statistics.
+    ASSERT(type_id < GC_MAX_TYPE_COUNT, "too many object types");
+    gc->stats.survivors[type_id] = 0;
+
     ASSERT(align >= alignof(GcObject));
+    ASSERT(type_id <= (~GC_FLAG_MASK >> GC_TYPE_SHIFT));
     gc->types[type_id].align = align;
     gc->types[type_id].object_size = object_size;
-    gc->types[type_id].copy_object = copy_object;
-    gc->types[type_id].get_children = get_children;
+    gc->types[type_id].scan_object = scan_object;
 
     gc->type_count += 1;
     return type_id;
@@ -117,264 +426,959 @@ loop:
     goto loop;
 }
 
-static void gc_arena_resize(Arena* arena) {
-    size_t capacity = arena_capacity(arena);
-    if (!grow_capacity(&capacity, sizeof(uint8_t), INITIAL_REGION_SIZE)) {
-        goto handle_err;
-    }
+// Abandons the current allocation once the heap can't grow any further.
+static void gc_out_of_memory(Gc* gc) {
+    gc->collecting = false;
+    gc->minor = false;
 
-    arena_free(arena);
-    if (arena_init(arena, capacity)) return;
+    if (gc->oom_handler != NULL) {
+        longjmp(*gc->oom_handler, 1);
+    }
 
-    // Resize failed.
-handle_err:
-    fprintf(stderr, "resize of gc arena failed\n");
+    fprintf(stderr, "gc heap exhausted\n");
     exit(EXIT_FAILURE);
 }
 
-static void gc_clear_forwarding_object(Gc* gc, GcObject* object) {
-    if (object->forward_ptr == NULL) return;
-    object->forward_ptr = NULL;
-#ifdef DEBUG_LOG_GC
-    printf("gc clearing forward ptr %p\n", object);
-#endif
+// Replaces `arena` with an empty arena of the given capacity, leaving it
+// untouched if allocation fails.
+static bool gc_arena_replace(Gc* gc, Arena* arena, size_t capacity) {
+    if (arena_resize(arena, capacity)) return true;
 
-    size_t type_id = gc_object_type(object);
-    GcType type = gc->types[type_id];
+    Arena replacement;
+    if (!gc_arena_init(gc, &replacement, capacity)) return false;
 
-    GcObject* position = NULL;
-    while ((position = type.get_children(object, position)) != NULL) {
-        gc_clear_forwarding_object(gc, position);
-    }
+    arena_free(arena);
+    *arena = replacement;
+    return true;
 }
 
-static void gc_clear_forwarding(Gc* gc) {
-    for (size_t i = 0; i < gc->root_count; i++) {
-        if (*gc->roots[i] == NULL) continue;
-        gc_clear_forwarding_object(gc, *gc->roots[i]);
+// Returns `size` scaled by `factor`, limited to the maximum semispace size.
+static size_t gc_scale_size(Gc* gc, size_t size, double factor) {
+    double scaled = (double) size * factor;
+    if (scaled >= (double) gc->max_semispace_size) {
+        return gc->max_semispace_size;
     }
+
+    return (size_t) scaled;
 }
 
-void gc_collect(Gc* gc) {
-#ifdef DEBUG_LOG_GC
-    printf("gc collect begin\n");
-    printf("----------------------------\n");
-#endif
-    gc->collecting = true;
+// Grows `arena` so that it can hold at least `required` bytes, or as much as
+// the heap limit allows, discarding its contents.
+static void gc_arena_reserve(Gc* gc, Arena* arena, size_t required) {
+    if (required > gc->max_semispace_size) {
+        required = gc->max_semispace_size;
+    }
 
-    // Save position in case we run out of memory.
-reset_mark:
-    if (setjmp(gc->collect_mark) != 0) {
-        gc_arena_resize(&gc->inactive);
+    size_t capacity = arena_capacity(arena);
+    if (capacity >= required) return;
 
-        gc_clear_forwarding(gc);
-        goto reset_mark;
+    size_t grown = gc_scale_size(gc, capacity, gc->config.growth_factor);
+    if (grown < required) grown = required;
+
+    if (!gc_arena_replace(gc, arena, grown)) gc_out_of_memory(gc);
+}
+
+// Sizes the semispace freed by a full collection for the next one.
+//
+// The heap grows as soon as the live data exceeds the target ratio, but only
+// shrinks after several consecutive collections find it underused, so that a
+// brief lull doesn't cause the heap to be regrown.
+static void gc_resize_inactive(Gc* gc) {
+    size_t capacity = arena_capacity(&gc->active);
+    size_t live = gc->active.next - gc->active.base;
+
+    // Leave room to promote a full nursery along with the live data.
+    double ratio = gc->config.target_live_ratio;
+    size_t desired = gc_scale_size(gc, live, 1.0 / ratio);
+    if (desired < live + NURSERY_SIZE) desired = live + NURSERY_SIZE;
+    if (desired < gc->config.initial_size) desired = gc->config.initial_size;
+    if (desired > gc->max_semispace_size) desired = gc->max_semispace_size;
+
+    size_t target = capacity;
+    if (desired > capacity) {
+        target = gc_scale_size(gc, capacity, gc->config.growth_factor);
+        if (target < desired) target = desired;
+
+        gc->underused_count = 0;
+    } else if ((double) desired * gc->config.growth_factor <= capacity) {
+        gc->underused_count += 1;
+        if (gc->underused_count >= gc->config.shrink_after) {
+            target = desired;
+            gc->underused_count = 0;
+        }
+    } else {
+        gc->underused_count = 0;
     }
 
-    // Create a copy of each of the roots.
-    //
-    // We can't actually update the roots yet, since an allocation could fail.
-    for (size_t index = 0; index < gc->root_count; index++) {
-        GcObject** root = gc->roots[index];
+    if (target != arena_capacity(&gc->inactive)) {
+        gc_arena_replace(gc, &gc->inactive, target);
+    }
 
-        if (*root == NULL) continue;
-#ifdef DEBUG_LOG_GC
-        printf("gc copy root %p\n", root);
-#endif
-        gc_copy_object(gc, *root);
+    // The inactive semispace is unused until the next full collection, so its
+    // memory can be returned in the meantime.
+    arena_release(&gc->inactive);
+}
+
+static void gc_remember(Gc* gc, GcObject* object) {
+    if (gc->remembered_count >= gc->remembered_capacity) {
+        bool success = GROW(
+            &gc->remembered,
+            &gc->remembered_capacity,
+            sizeof(GcObject*),
+            128
+        );
+        if (!success) {
+            fprintf(stderr, "growing remembered set failed\n");
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Assign the results of the copy to the roots.
-    for (size_t index = 0; index < gc->root_count; index++) {
-        GcObject** root = gc->roots[index];
+    object->header |= GC_FLAG_REMEMBERED;
+    gc->remembered[gc->remembered_count] = object;
+    gc->remembered_count += 1;
+}
+
+void gc_write_barrier(Gc* gc, GcObject* object) {
+    if (arena_contains(&gc->nursery, object)) return;
+    if ((object->header & GC_FLAG_REMEMBERED) != 0) return;
 
-        // Support NULL roots to make preparation easier.
-        if (*root == NULL) continue;
+    gc_remember(gc, object);
+}
+
+// Returns the object located at `*position` in the arena, stepping over any
+// alignment padding, or `NULL` if `end` has been reached.
+static GcObject* gc_next_copied_object(uint8_t** position, uint8_t* end) {
+    while (*position < end) {
+        GcObject* object = (GcObject*) *position;
+        if (object->header != GC_PADDING) return object;
 
-        // If the forward pointer is NULL, there are multiple rooting of this
-        // location and we've already updated the root.
-        if ((*root)->forward_ptr == NULL) continue;
-        *root = (*root)->forward_ptr;
+        *position += sizeof(size_t);
     }
 
-    // The garbage collection has completed successfully.
-    // Swap the arenas to prepare for additional allocation.
-    Arena swap = gc->active;
-    gc->active = gc->inactive;
-    gc->inactive = swap;
+    return NULL;
+}
 
-    // Reset the old arena
-    arena_reset(&gc->inactive);
-    gc->collecting = false;
-#ifdef DEBUG_LOG_GC
-    printf("----------------------------\n");
-    printf("gc collect end\n");
-#endif
+static size_t gc_copied_object_size(Gc* gc, GcObject* object) {
+    GcType type = gc->types[gc_object_type(object)];
+    return gc_round_size(type.object_size(object));
 }
 
-GcObject* gc_copy_object(Gc* gc, GcObject* object) {
-    if (object->forward_ptr != NULL) {
-        return object->forward_ptr;
+// Scans every copied object in the arena starting at `position`, returning
+// the position at which the scan stopped.
+//
+// Forwarded children are appended to the same arena, so the collection is
+// complete once the scan catches up with allocation.
+static uint8_t* gc_scan_copied_objects(
+    Gc* gc,
+    Arena* arena,
+    uint8_t* position
+) {
+    GcObject* object;
+    while ((object = gc_next_copied_object(&position, arena->next)) != NULL) {
+        GcType type = gc->types[gc_object_type(object)];
+        type.scan_object(gc, object);
+
+        position += gc_round_size(type.object_size(object));
     }
 
-    size_t type_id = gc_object_type(object);
-    GcType type = gc->types[type_id];
-    GcObject* new_object = gc_alloc(gc, type_id, type.object_size(object));
+    return position;
+}
 
-    object->forward_ptr = new_object;
-    type.copy_object(gc, object, new_object);
+static GcLargeObject* gc_large_header(GcObject* object) {
+    return (GcLargeObject*) ((uint8_t*) object - sizeof(GcLargeObject));
+}
 
-    return object->forward_ptr;
+static GcObject* gc_large_object(GcLargeObject* large) {
+    return (GcObject*) ((uint8_t*) large + sizeof(GcLargeObject));
 }
 
-GcObject* gc_alloc(Gc* gc, size_t type_id, size_t size) {
-#ifdef DEBUG_LOG_GC
-    printf("gc alloc type %zu\n", type_id);
-#endif
-    ASSERT(type_id < gc->type_count);
-    GcType type = gc->types[type_id];
-    GcObject* object = (GcObject*) gc_alloc_untyped(gc, size, type.align);
+// Marks a large object reached by a full collection, queueing it to have its
+// children forwarded.
+static void gc_mark_large(Gc* gc, GcObject* object) {
+    GcCopyThread* thread = gc_copy_thread;
+    if (thread != NULL) {
+        size_t header = __atomic_fetch_or(
+            &object->header,
+            GC_FLAG_MARKED,
+            __ATOMIC_RELAXED
+        );
+        if ((header & GC_FLAG_MARKED) == 0) {
+            gc_workers_push(&gc->workers, thread->index, object);
+        }
+        return;
+    }
 
-    object->flags = type_id;
-    object->forward_ptr = NULL;
-    return object;
+    if ((object->header & GC_FLAG_MARKED) != 0) return;
+    object->header |= GC_FLAG_MARKED;
+
+    GcLargeObject* large = gc_large_header(object);
+    large->next_gray = gc->gray_objects;
+    gc->gray_objects = large;
 }
 
-void* gc_alloc_untyped(Gc* gc, size_t size, size_t align) {
-#ifdef DEBUG_LOG_GC
-    printf("gc alloc %zu bytes with %zu align\n", size, align);
-#endif
+// Scans to-space and the marked large objects until neither has any objects
+// left whose children haven't been forwarded.
+static void gc_scan_major(Gc* gc) {
+    uint8_t* position = gc->inactive.base;
+    do {
+        position = gc_scan_copied_objects(gc, &gc->inactive, position);
 
-#ifdef DEBUG_STRESS_GC
-    if (!gc->collecting) gc_collect(gc);
-#endif
+        while (gc->gray_objects != NULL) {
+            GcLargeObject* large = gc->gray_objects;
+            gc->gray_objects = large->next_gray;
 
-    Arena* arena = gc->collecting ? &gc->inactive : &gc->active;
+            GcObject* object = gc_large_object(large);
+            gc->types[gc_object_type(object)].scan_object(gc, object);
+        }
+    } while (position < gc->inactive.next);
+}
 
-    void* ptr = (void*) arena_alloc(arena, size, align, 1);
-    if (ptr != NULL) goto handle_success;
+// Frees every large object that wasn't marked by the last full collection.
+static void gc_sweep_large(Gc* gc) {
+    size_t live = 0;
 
-    // Initial allocation attempt failed.
-    //
-    // If a collection is happening, we reset to the start of the GC process.
-    if (gc->collecting) longjmp(gc->collect_mark, 1);
+    GcLargeObject** link = &gc->large_objects;
+    while (*link != NULL) {
+        GcLargeObject* large = *link;
+        GcObject* object = gc_large_object(large);
 
-    gc_collect(gc);
-    while ((ptr = arena_alloc(arena, size, align, 1)) == NULL) {
-        Arena* growth_arena = gc->collecting ? &gc->active : &gc->inactive;
-        gc_arena_resize(growth_arena);
+        if ((object->header & GC_FLAG_MARKED) == 0) {
+            *link = large->next;
+            free(large->block);
+            continue;
+        }
 
-        gc_collect(gc);
+        // The remembered set is emptied by every full collection.
+        object->header &= ~(GC_FLAG_MARKED | GC_FLAG_REMEMBERED);
+        gc->stats.survivors[gc_object_type(object)] += 1;
+        live += large->size;
+        link = &large->next;
     }
 
-handle_success:
-    return ptr;
+    gc->large_size = live;
+
+    // Give the large object space the same room to grow as the old
+    // generation before it triggers another collection.
+    double limit = (double) live * gc->config.growth_factor;
+    gc->large_limit = limit < (double) SIZE_MAX ? (size_t) limit : SIZE_MAX;
+    if (gc->large_limit < gc->config.initial_size) {
+        gc->large_limit = gc->config.initial_size;
+    }
 }
 
-#ifdef ENABLE_TESTS
+static void gc_log_forwarded(Gc* gc, GcObject* object) {
+    if (gc->forwarded_count >= gc->forwarded_capacity) {
+        bool success = GROW(
+            &gc->forwarded,
+            &gc->forwarded_capacity,
+            sizeof(GcObject*),
+            128
+        );
+        if (!success) {
+            fprintf(stderr, "growing forwarding log failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-#include "test.h"
+    gc->forwarded[gc->forwarded_count] = object;
+    gc->forwarded_count += 1;
+}
 
-typedef struct {
-    GcObject object;
-    size_t len;
-    size_t val;
-} GcArray;
+// Undoes a partial collection.
+//
+// Each copy still holds the header of its original, which the forwarding log
+// leads back to.
+static void gc_clear_forwarding(Gc* gc) {
+    for (size_t index = 0; index < gc->forwarded_count; index++) {
+        GcObject* object = gc->forwarded[index];
+        GcObject* copy = gc_forwarded(object->header);
+#ifdef DEBUG_LOG_GC
+        printf("gc clearing forward ptr %p\n", copy);
+#endif
+        object->header = copy->header;
+    }
+    gc->forwarded_count = 0;
 
-size_t gc_array_size(GcObject* object) {
-    return sizeof(GcArray) + ((GcArray*) object)->len;
+    GcLargeObject* large = gc->large_objects;
+    for (; large != NULL; large = large->next) {
+        gc_large_object(large)->header &= ~GC_FLAG_MARKED;
+    }
+    gc->gray_objects = NULL;
 }
 
-void gc_array_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    ((GcArray*) new_object)->len = ((GcArray*) object)->len;
-    ((GcArray*) new_object)->val = ((GcArray*) object)->val;
+static void gc_copy_root(Gc* gc, GcObject** root) {
+    if (!gc_is_object(*root)) return;
+#ifdef DEBUG_LOG_GC
+    printf("gc copy root %p\n", root);
+#endif
+    gc_copy_object(gc, *root);
 }
 
-GcObject* gc_array_get_children(GcObject* object, GcObject* position) {
-    return NULL;
+static void gc_update_root(Gc* gc, GcObject** root) {
+    // Support NULL roots to make preparation easier.
+    if (!gc_is_object(*root)) return;
+
+    // If the root already points into to-space, there are multiple
+    // rootings of this location and we've already updated the root.
+    if (arena_contains(&gc->inactive, *root)) return;
+
+    // Large objects never move.
+    if (((*root)->header & GC_FLAG_LARGE) != 0) return;
+    *root = gc_forwarded((*root)->header);
 }
 
-bool gc_handle_failed_alloc_during_collect() {
-    Gc gc;
-    if (!gc_init(&gc)) {
-        return false;
+// Fills `[start, end)` of to-space with padding so that it can be walked.
+static void gc_fill_padding(uint8_t* start, uint8_t* end) {
+    for (size_t* word = (size_t*) start; word < (size_t*) end; word++) {
+        *word = GC_PADDING;
     }
+}
 
-    bool result = false;
+// Gives up the rest of a thread's to-space buffer.
+static void gc_retire_lab(GcCopyThread* thread) {
+    gc_fill_padding(thread->next, thread->end);
+    thread->next = NULL;
+    thread->end = NULL;
+}
 
-    size_t low_align = gc_add_type(
-        &gc,
-        alignof(GcArray),
-        gc_array_size,
-        gc_array_copy,
-        gc_array_get_children
-    );
+// Allocates to-space for a parallel collection thread, claiming a new buffer
+// once its current one is full.
+static GcObject* gc_lab_alloc(
+    Gc* gc,
+    GcCopyThread* thread,
+    size_t size,
+    size_t align
+) {
+    uintptr_t mask = align - 1;
+    uint8_t* start = (uint8_t*) (((uintptr_t) thread->next + mask) & ~mask);
+    if (start > thread->end || size > (size_t) (thread->end - start)) {
+        gc_retire_lab(thread);
+
+        pthread_mutex_lock(&gc->to_space_lock);
+        size_t available = gc->inactive.end - gc->inactive.next;
+        size_t claim = available < GC_LAB_SIZE ? available : GC_LAB_SIZE;
+        claim &= ~(alignof(GcObject) - 1);
+
+        uint8_t* lab = claim == 0
+            ? NULL
+            : arena_alloc(&gc->inactive, claim, alignof(GcObject), 1);
+        pthread_mutex_unlock(&gc->to_space_lock);
+        if (lab == NULL) return NULL;
+
+        thread->next = lab;
+        thread->end = lab + claim;
+
+        start = (uint8_t*) (((uintptr_t) lab + mask) & ~mask);
+        if (start > thread->end || size > (size_t) (thread->end - start)) {
+            return NULL;
+        }
+    }
 
-    size_t align =
-        INITIAL_REGION_SIZE > alignof(GcArray)
-        ? INITIAL_REGION_SIZE
-        : alignof(GcArray);
-    size_t high_align = gc_add_type(
-        &gc,
-        align,
-        gc_array_size,
-        gc_array_copy,
-        gc_array_get_children
-    );
+    thread->last = thread->next;
+    gc_fill_padding(thread->next, start);
+    thread->next = start + size;
+    return (GcObject*) start;
+}
 
-    GcObject* low[8];
-    GcObject* high[8];
+// Copies `object` on behalf of a parallel collection thread.
+//
+// Threads race to install their copy as the forwarding pointer, and the
+// losers give their copy back.
+static GcObject* gc_copy_object_parallel(
+    Gc* gc,
+    GcCopyThread* thread,
+    GcObject* object
+) {
+    size_t header = __atomic_load_n(&object->header, __ATOMIC_ACQUIRE);
+    GcObject* forwarded = gc_forwarded(header);
+    if (forwarded != NULL) return forwarded;
 
-    for (size_t i = 0; i < countof(high); i++) {
-        high[i] = gc_alloc(&gc, high_align, sizeof(GcArray));
-        ((GcArray*) high[i])->len = 0;
-        ((GcArray*) high[i])->val = i;
-        GC_ROOT(&gc, &high[i]);
+    if ((header & GC_FLAG_LARGE) != 0) {
+        gc_mark_large(gc, object);
+        return object;
     }
 
-    for (size_t i = 0; i < countof(low); i++) {
-        low[i] = gc_alloc(&gc, low_align, sizeof(GcArray));
-        ((GcArray*) low[i])->len = 0;
-        ((GcArray*) low[i])->val = i;
-        GC_ROOT(&gc, &low[i]);
+    GcType type = gc->types[gc_header_type(header)];
+    size_t size = gc_round_size(type.object_size(object));
+
+    // To-space is sized so that this can't fail, see
+    // `gc_collect_with_headroom`.
+    GcObject* new_object = gc_lab_alloc(gc, thread, size, type.align);
+    ASSERT(new_object != NULL, "parallel collections must fit into to-space");
+
+    // The header of the original may be written concurrently, so only the
+    // rest of the object is copied.
+    new_object->header = header;
+    memcpy(new_object + 1, object + 1, size - sizeof(GcObject));
+
+    bool installed = __atomic_compare_exchange_n(
+        &object->header,
+        &header,
+        (size_t) new_object | GC_FORWARDED,
+        false,
+        __ATOMIC_ACQ_REL,
+        __ATOMIC_ACQUIRE
+    );
+    if (!installed) {
+        // The copy is the most recent allocation in the buffer. Its padding is
+        // given back too, since only the winning copy is covered by the slack.
+        thread->next = thread->last;
+        return gc_forwarded(header);
     }
 
-    for (size_t i = 0; i < countof(high); i++) {
-        GC_UNROOT(&gc, &low[i]);
-        GC_UNROOT(&gc, &high[i]);
+    gc_workers_push(&gc->workers, thread->index, new_object);
+    return new_object;
+}
+
+// Copies a share of the roots, then scans copied objects until every thread
+// runs out of work.
+static void gc_copy_parallel_task(
+    GcWorkers* workers,
+    size_t index,
+    void* context
+) {
+    Gc* gc = (Gc*) context;
+    GcCopyThread thread = { index, NULL, NULL, NULL };
+    gc_copy_thread = &thread;
+
+    for (size_t i = index; i < gc->root_count; i += workers->count) {
+        gc_copy_root(gc, gc->roots[i]);
     }
 
-    for (size_t i = 0; i < countof(high); i++) {
-        GC_ROOT(&gc, &low[i]);
-        GC_ROOT(&gc, &high[i]);
+    size_t slot = 0;
+    for (GcFrame* frame = gc->frames; frame != NULL; frame = frame->prev) {
+        for (size_t i = 0; i < frame->count; i++, slot++) {
+            if (slot % workers->count != index) continue;
+            gc_copy_root(gc, (GcObject**) frame->slots[i]);
+        }
     }
 
-    for (size_t i = 0; i < countof(high); i++) {
-        if (((GcArray*) low[i])->val != i) goto cleanup;
-        if (((GcArray*) high[i])->val != i) goto cleanup;
+    GcObject* object;
+    while ((object = gc_workers_take(workers, index)) != NULL) {
+        gc->types[gc_object_type(object)].scan_object(gc, object);
     }
 
-    gc_collect(&gc);
-    result = true;
-cleanup:
-    gc_free(&gc);
-    return result;
+    gc_retire_lab(&thread);
+    gc_copy_thread = NULL;
 }
 
-bool gc_support_redundant_rooting() {
-    Gc gc;
-    if (!gc_init(&gc)) {
-        return false;
+// Copies every live object into to-space using all of the workers.
+//
+// Must only be used when to-space can hold every survivor, since a parallel
+// collection can't be undone.
+static void gc_copy_parallel(Gc* gc) {
+    gc_workers_run(&gc->workers, gc_copy_parallel_task, gc);
+}
+
+// Runs a full collection, leaving at least `headroom` bytes free in the old
+// generation unless the heap limit is reached.
+static void gc_collect_with_headroom(Gc* gc, size_t headroom) {
+#ifdef DEBUG_LOG_GC
+    printf("gc collect begin\n");
+    printf("----------------------------\n");
+#endif
+    uint64_t start = gc_now_ns();
+
+    // Size to-space for everything that could survive, including worst-case
+    // alignment padding, so that copying never runs out of space.
+    size_t required =
+        (size_t) (gc->active.next - gc->active.base)
+        + (size_t) (gc->nursery.next - gc->nursery.base)
+        + gc->old_slack
+        + gc->nursery_slack
+        + headroom;
+
+    // Parallel collections also waste the end of each thread's buffers. A
+    // buffer is only retired early when the next object and its padding don't
+    // fit, and together they take at most a quarter of a buffer, so less than
+    // a third of what a retired buffer holds is wasted. The last buffer of
+    // each thread may be wasted entirely. With room for both, every claim gets
+    // a full buffer and copying can't run out of to-space.
+    size_t parallel_required = required;
+    if (gc->workers.count > 1) {
+        parallel_required += required / 3 + gc->workers.count * GC_LAB_SIZE;
     }
+    gc_arena_reserve(gc, &gc->inactive, parallel_required);
 
-    bool result = false;
+    // To-space can only run out if the heap limit kept it from being sized
+    // above, in which case the live data might not fit into the heap.
+    size_t capacity = arena_capacity(&gc->inactive);
+    bool parallel = gc->workers.count > 1 && capacity >= parallel_required;
+    gc->log_forwarding = capacity < required;
 
-    size_t type_id = gc_add_type(
+    gc->collecting = true;
+    if (setjmp(gc->collect_mark) != 0) {
+        gc_clear_forwarding(gc);
+        arena_reset(&gc->inactive);
+        gc->log_forwarding = false;
+        gc_out_of_memory(gc);
+    }
+
+    // Create a copy of each of the roots.
+    //
+    // We can't actually update the roots yet, since an allocation could fail.
+    if (parallel) {
+        gc_copy_parallel(gc);
+    } else {
+        for (size_t index = 0; index < gc->root_count; index++) {
+            gc_copy_root(gc, gc->roots[index]);
+        }
+
+        for (GcFrame* frame = gc->frames; frame != NULL; frame = frame->prev) {
+            for (size_t index = 0; index < frame->count; index++) {
+                gc_copy_root(gc, (GcObject**) frame->slots[index]);
+            }
+        }
+
+        gc_scan_major(gc);
+    }
+
+    // Assign the results of the copy to the roots.
+    for (size_t index = 0; index < gc->root_count; index++) {
+        gc_update_root(gc, gc->roots[index]);
+    }
+
+    for (GcFrame* frame = gc->frames; frame != NULL; frame = frame->prev) {
+        for (size_t index = 0; index < frame->count; index++) {
+            gc_update_root(gc, (GcObject**) frame->slots[index]);
+        }
+    }
+
+    // The copy can no longer be undone. Copies keep the header of their
+    // original until now, but the remembered set is about to be emptied.
+    gc->log_forwarding = false;
+    gc->forwarded_count = 0;
+    gc->old_slack = 0;
+    uint8_t* position = gc->inactive.base;
+    GcObject* object;
+    while ((object = gc_next_copied_object(&position, gc->inactive.next))) {
+        object->header &= ~GC_FLAG_REMEMBERED;
+
+        size_t size = gc_copied_object_size(gc, object);
+        gc_record_survivor(gc, object, size);
+        position += size;
+    }
+
+    // The garbage collection has completed successfully.
+    // Swap the arenas to prepare for additional allocation.
+    Arena swap = gc->active;
+    gc->active = gc->inactive;
+    gc->inactive = swap;
+
+    // Reset the old arena and the nursery, whose survivors now live in the
+    // old generation.
+    gc_resize_inactive(gc);
+    gc_sweep_large(gc);
+    arena_reset(&gc->nursery);
+    gc->nursery_slack = 0;
+    gc->remembered_count = 0;
+
+    gc->collecting = false;
+
+    gc->stats.major_collections += 1;
+    gc_update_heap_size(gc);
+    gc_record_pause(gc, start);
+#ifdef DEBUG_LOG_GC
+    printf("----------------------------\n");
+    printf("gc collect end\n");
+#endif
+}
+
+void gc_collect(Gc* gc) {
+    gc_collect_with_headroom(gc, 0);
+}
+
+// Promotes every live object in the nursery into the old generation.
+//
+// The caller must ensure that the old generation can hold the entire nursery.
+static void gc_collect_minor(Gc* gc) {
+#ifdef DEBUG_LOG_GC
+    printf("gc minor collect begin\n");
+    printf("----------------------------\n");
+#endif
+    uint64_t start = gc_now_ns();
+    gc->collecting = true;
+    gc->minor = true;
+
+    uint8_t* promoted = gc->active.next;
+
+    // Promotion can't run out of space, so roots can be updated immediately.
+    for (size_t index = 0; index < gc->root_count; index++) {
+        GC_SCAN_FIELD(gc, *gc->roots[index]);
+    }
+
+    for (GcFrame* frame = gc->frames; frame != NULL; frame = frame->prev) {
+        for (size_t index = 0; index < frame->count; index++) {
+            GC_SCAN_FIELD(gc, *(GcObject**) frame->slots[index]);
+        }
+    }
+
+    // Old objects that were written to may be the only references to objects
+    // in the nursery.
+    for (size_t index = 0; index < gc->remembered_count; index++) {
+        GcObject* object = gc->remembered[index];
+        object->header &= ~GC_FLAG_REMEMBERED;
+
+        gc->types[gc_object_type(object)].scan_object(gc, object);
+    }
+    gc->remembered_count = 0;
+
+    gc_scan_copied_objects(gc, &gc->active, promoted);
+
+    GcObject* object;
+    while ((object = gc_next_copied_object(&promoted, gc->active.next))) {
+        size_t size = gc_copied_object_size(gc, object);
+        gc_record_survivor(gc, object, size);
+        promoted += size;
+    }
+
+    arena_reset(&gc->nursery);
+    gc->nursery_slack = 0;
+
+    gc->minor = false;
+    gc->collecting = false;
+
+    gc->stats.minor_collections += 1;
+    gc_record_pause(gc, start);
+#ifdef DEBUG_LOG_GC
+    printf("----------------------------\n");
+    printf("gc minor collect end\n");
+#endif
+}
+
+static bool gc_can_promote_nursery(Gc* gc) {
+    size_t available = gc->active.end - gc->active.next;
+    size_t used = gc->nursery.next - gc->nursery.base;
+    return used <= available && gc->nursery_slack <= available - used;
+}
+
+// Empties the nursery, using a full collection when the old generation may
+// not be able to hold every survivor.
+//
+// Full collections size the old generation to fit a full nursery, so later
+// collections can be minor ones.
+static void gc_collect_nursery(Gc* gc) {
+    if (gc_can_promote_nursery(gc)) {
+        gc_collect_minor(gc);
+    } else {
+        gc_collect(gc);
+    }
+}
+
+// Copies `object` out of from-space without touching its children, which are
+// forwarded later when the copy is scanned.
+static GcObject* gc_copy_object(Gc* gc, GcObject* object) {
+    GcCopyThread* thread = gc_copy_thread;
+    if (thread != NULL) {
+        return gc_copy_object_parallel(gc, thread, object);
+    }
+
+    if ((object->header & GC_FLAG_LARGE) != 0) {
+        gc_mark_large(gc, object);
+        return object;
+    }
+
+    GcObject* forwarded = gc_forwarded(object->header);
+    if (forwarded != NULL) {
+        return forwarded;
+    }
+
+    // Minor collections copy into the old generation.
+    Arena* arena = gc->minor ? &gc->active : &gc->inactive;
+
+    GcType type = gc->types[gc_object_type(object)];
+    size_t size = gc_round_size(type.object_size(object));
+
+    // Fill any alignment padding so that the arena can be walked linearly.
+    size_t padding = (-(uintptr_t) arena->next) & (type.align - 1);
+    if (padding != 0) {
+        size_t count = padding / sizeof(size_t);
+        size_t* words = (size_t*)
+            arena_alloc(arena, sizeof(size_t), alignof(size_t), count);
+        if (words == NULL) longjmp(gc->collect_mark, 1);
+
+        for (size_t i = 0; i < count; i++) {
+            words[i] = GC_PADDING;
+        }
+    }
+
+    // A full collection only runs out of space once the heap limit has been
+    // reached.
+    GcObject* new_object = (GcObject*) arena_alloc(arena, size, type.align, 1);
+    if (new_object == NULL) {
+        ASSERT(!gc->minor, "promotion must not run out of space");
+        longjmp(gc->collect_mark, 1);
+    }
+    memcpy(new_object, object, size);
+
+    object->header = (size_t) new_object | GC_FORWARDED;
+    if (gc->log_forwarding) gc_log_forwarded(gc, object);
+    return new_object;
+}
+
+void gc_scan_field(Gc* gc, GcObject** field) {
+    ASSERT(gc->collecting == true);
+    if (!gc_is_object(*field)) return;
+
+    // Minor collections only move objects out of the nursery.
+    if (gc->minor && !arena_contains(&gc->nursery, *field)) return;
+
+    *field = gc_copy_object(gc, *field);
+}
+
+// Runs the collections forced by stress testing before an allocation.
+static void gc_stress(Gc* gc) {
+#ifdef DEBUG_STRESS_GC
+    if (gc->stress_paused) return;
+
+    // Alternate between collection kinds to exercise both the write barrier
+    // and full collections.
+    gc->stress_count += 1;
+    if (gc->stress_count % 8 == 0) {
+        gc_collect(gc);
+    } else {
+        gc_collect_nursery(gc);
+    }
+#else
+    (void) gc;
+#endif
+}
+
+// Allocates an object in the large object space, where it is marked and swept
+// by full collections instead of being copied.
+static GcObject* gc_alloc_large(Gc* gc, size_t size, size_t align) {
+    ASSERT(gc->collecting == false);
+    gc_stress(gc);
+
+    // The header and the alignment padding are charged to the object, so
+    // that the limits below bound the memory that is actually reserved.
+    size_t block_size = sizeof(GcLargeObject) + (align - 1) + size;
+    if (block_size < size) gc_out_of_memory(gc);
+
+    gc->stats.bytes_allocated += size;
+    if (gc->large_size + block_size > gc->large_limit) {
+        gc_collect(gc);
+    }
+
+    // Large objects count towards the heap limit, which may be reached even
+    // after a collection.
+    size_t max_heap = gc->config.max_heap_size;
+    if (max_heap != 0) {
+        gc_update_heap_size(gc);
+        size_t used = gc->stats.heap_size;
+        if (used > max_heap || block_size > max_heap - used) {
+            gc_out_of_memory(gc);
+        }
+    }
+
+    uint8_t* block = (uint8_t*) malloc(block_size);
+    if (block == NULL) gc_out_of_memory(gc);
+
+    uintptr_t start = (uintptr_t) (block + sizeof(GcLargeObject));
+    GcObject* object =
+        (GcObject*) ((start + (align - 1)) & ~(uintptr_t) (align - 1));
+
+    GcLargeObject* large = gc_large_header(object);
+    large->next = gc->large_objects;
+    large->next_gray = NULL;
+    large->block = block;
+    large->size = block_size;
+
+    gc->large_objects = large;
+    gc->large_size += block_size;
+    gc_update_heap_size(gc);
+    return object;
+}
+
+GcObject* gc_alloc(Gc* gc, size_t type_id, size_t size) {
+#ifdef DEBUG_LOG_GC
+    printf("gc alloc type %zu\n", type_id);
+#endif
+    ASSERT(type_id < gc->type_count);
+    GcType type = gc->types[type_id];
+    size = gc_round_size(size);
+
+    // Large objects are never copied, so that the cost of a collection
+    // doesn't depend on their size.
+    if (size + (type.align - 1) > GC_LARGE_OBJECT_SIZE) {
+        GcObject* object = gc_alloc_large(gc, size, type.align);
+        object->header = (type_id << GC_TYPE_SHIFT) | GC_FLAG_LARGE;
+
+        // Large objects are initialized without write barriers.
+        gc_remember(gc, object);
+        return object;
+    }
+
+    GcObject* object = (GcObject*) gc_alloc_untyped(gc, size, type.align);
+
+    object->header = type_id << GC_TYPE_SHIFT;
+
+    // Objects placed directly into the old generation are initialized without
+    // write barriers.
+    size_t slack =
+        type.align > alignof(GcObject) ? gc_align_slack(type.align) : 0;
+    if (!arena_contains(&gc->nursery, object)) {
+        gc_remember(gc, object);
+        gc->old_slack += slack;
+    } else {
+        gc->nursery_slack += slack;
+    }
+
+    return object;
+}
+
+static void* gc_alloc_old(Gc* gc, size_t size, size_t align) {
+    // Keep the old generation word aligned so that promoted objects can be
+    // walked.
+    size = gc_round_size(size);
+
+    void* ptr = (void*) arena_alloc(&gc->active, size, align, 1);
+    if (ptr != NULL) return ptr;
+
+    gc_collect_with_headroom(gc, size + align);
+
+    ptr = (void*) arena_alloc(&gc->active, size, align, 1);
+    if (ptr == NULL) gc_out_of_memory(gc);
+    return ptr;
+}
+
+void* gc_alloc_untyped(Gc* gc, size_t size, size_t align) {
+#ifdef DEBUG_LOG_GC
+    printf("gc alloc %zu bytes with %zu align\n", size, align);
+#endif
+    ASSERT(gc->collecting == false);
+    gc_stress(gc);
+
+    gc->stats.bytes_allocated += size;
+    if (size + (align - 1) > NURSERY_MAX_OBJECT_SIZE) {
+        return gc_alloc_old(gc, size, align);
+    }
+
+    void* ptr = (void*) arena_alloc(&gc->nursery, size, align, 1);
+    if (ptr != NULL) return ptr;
+
+    gc_collect_nursery(gc);
+
+    ptr = (void*) arena_alloc(&gc->nursery, size, align, 1);
+    ASSERT(ptr != NULL, "allocation must fit into an empty nursery");
+    return ptr;
+}
+
+#ifdef ENABLE_TESTS
+
+#include "test.h"
+
+typedef struct {
+    GcObject object;
+    size_t len;
+    size_t val;
+} GcArray;
+
+size_t gc_array_size(GcObject* object) {
+    return sizeof(GcArray) + ((GcArray*) object)->len;
+}
+
+void gc_array_scan(Gc* gc, GcObject* object) {}
+
+typedef struct GcLink GcLink;
+struct GcLink {
+    GcObject object;
+    GcLink* next;
+    size_t val;
+};
+
+size_t gc_link_size(GcObject* object) {
+    return sizeof(GcLink);
+}
+
+void gc_link_scan(Gc* gc, GcObject* object) {
+    GC_SCAN_FIELD(gc, ((GcLink*) object)->next);
+}
+
+bool gc_size_to_space_for_over_aligned_objects() {
+    // Start with a tiny heap so that to-space must grow to fit the padding
+    // required by the objects below.
+    GcConfig config;
+    gc_config_default(&config);
+    config.initial_size = 4096;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t low_align = gc_add_type(
+        &gc,
+        alignof(GcArray),
+        gc_array_size,
+        gc_array_scan
+    );
+
+    size_t align =
+        config.initial_size > alignof(GcArray)
+        ? config.initial_size
+        : alignof(GcArray);
+    size_t high_align = gc_add_type(
+        &gc,
+        align,
+        gc_array_size,
+        gc_array_scan
+    );
+
+    GcObject* low[8];
+    GcObject* high[8];
+
+    for (size_t i = 0; i < countof(high); i++) {
+        high[i] = gc_alloc(&gc, high_align, sizeof(GcArray));
+        ((GcArray*) high[i])->len = 0;
+        ((GcArray*) high[i])->val = i;
+        GC_ROOT(&gc, &high[i]);
+    }
+
+    for (size_t i = 0; i < countof(low); i++) {
+        low[i] = gc_alloc(&gc, low_align, sizeof(GcArray));
+        ((GcArray*) low[i])->len = 0;
+        ((GcArray*) low[i])->val = i;
+        GC_ROOT(&gc, &low[i]);
+    }
+
+    for (size_t i = 0; i < countof(high); i++) {
+        GC_UNROOT(&gc, &low[i]);
+        GC_UNROOT(&gc, &high[i]);
+    }
+
+    for (size_t i = 0; i < countof(high); i++) {
+        GC_ROOT(&gc, &low[i]);
+        GC_ROOT(&gc, &high[i]);
+    }
+
+    for (size_t i = 0; i < countof(high); i++) {
+        if (((GcArray*) low[i])->val != i) goto cleanup;
+        if (((GcArray*) high[i])->val != i) goto cleanup;
+    }
+
+    gc_collect(&gc);
+    result = true;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_support_redundant_rooting() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
         &gc,
         alignof(GcArray),
         gc_array_size,
-        gc_array_copy,
-        gc_array_get_children
+        gc_array_scan
     );
 
     GcArray* obj = (GcArray*) gc_alloc(&gc, type_id, sizeof(GcArray));
@@ -394,9 +1398,604 @@ cleanup:
     return result;
 }
 
+bool gc_frame_roots_objects() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcArray),
+        gc_array_size,
+        gc_array_scan
+    );
+
+    GcArray* outer = NULL;
+    GcArray* shared = NULL;
+    GC_FRAME_BEGIN(&gc, &outer, &shared);
+
+    outer = (GcArray*) gc_alloc(&gc, type_id, sizeof(GcArray));
+    outer->len = 0;
+    outer->val = 0xA;
+
+    shared = (GcArray*) gc_alloc(&gc, type_id, sizeof(GcArray));
+    shared->len = 0;
+    shared->val = 0xB;
+
+    // Locations may be rooted by several frames and by `GC_ROOT`.
+    GC_ROOT(&gc, &shared);
+    {
+        GcArray* inner = NULL;
+        GC_FRAME_BEGIN(&gc, &inner, &shared);
+
+        inner = (GcArray*) gc_alloc(&gc, type_id, sizeof(GcArray));
+        inner->len = 0;
+        inner->val = 0xC;
+
+        gc_collect(&gc);
+        bool inner_ok = inner->val == 0xC;
+
+        GC_FRAME_END(&gc);
+        if (!inner_ok) goto cleanup;
+    }
+    GC_UNROOT(&gc, &shared);
+
+    gc_collect(&gc);
+    if (outer->val != 0xA || shared->val != 0xB) goto cleanup;
+
+    result = gc.frames == &gc_frame;
+cleanup:
+    GC_FRAME_END(&gc);
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_collect_long_chain() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    GcLink* head = NULL;
+    GC_ROOT(&gc, &head);
+
+    size_t length = 4096;
+    for (size_t i = 0; i < length; i++) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        link->next = head;
+        link->val = i;
+        head = link;
+    }
+
+    gc_collect(&gc);
+
+    GcLink* link = head;
+    for (size_t i = length; i > 0; i--) {
+        if (link == NULL || link->val != i - 1) goto cleanup;
+        link = link->next;
+    }
+
+    result = link == NULL;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_write_barrier_keeps_young_objects() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    GcLink* old = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+    old->next = NULL;
+    old->val = 0;
+    GC_ROOT(&gc, &old);
+
+    // Promote `old` out of the nursery.
+    gc_collect(&gc);
+    if (arena_contains(&gc.nursery, old)) goto cleanup;
+
+    GcLink* young = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+    young->next = NULL;
+    young->val = 1;
+
+    // `young` is only reachable through `old`.
+    old->next = young;
+    GC_WRITE_BARRIER(&gc, old);
+
+    for (size_t i = 0; i < 64; i++) {
+        GcLink* garbage = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        garbage->next = NULL;
+        garbage->val = 2;
+    }
+
+    if (old->next == NULL || old->next->val != 1) goto cleanup;
+    if (arena_contains(&gc.nursery, old->next)) goto cleanup;
+
+    result = true;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_heap_shrinks_after_spike() {
+    GcConfig config;
+    gc_config_default(&config);
+    config.initial_size = 4096;
+    config.shrink_after = 2;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    GcLink* head = NULL;
+    GC_ROOT(&gc, &head);
+
+    for (size_t i = 0; i < 16384; i++) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        link->next = head;
+        link->val = i;
+        head = link;
+    }
+
+    gc_collect(&gc);
+    size_t peak = arena_capacity(&gc.active);
+
+    head = NULL;
+    for (size_t i = 0; i < 2 * (config.shrink_after + 1); i++) {
+        gc_collect(&gc);
+    }
+
+    result = arena_capacity(&gc.active) < peak;
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_max_heap_size_is_enforced() {
+    GcConfig config;
+    gc_config_default(&config);
+    config.initial_size = 4096;
+    config.max_heap_size = NURSERY_SIZE + 2 * 64 * 1024;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    GcLink* head = NULL;
+    GC_ROOT(&gc, &head);
+
+    size_t root_count = gc.root_count;
+    jmp_buf handler;
+    if (setjmp(handler) != 0) {
+        gc.oom_handler = NULL;
+        gc.root_count = root_count;
+
+        // The heap must remain usable once the live data is released.
+        head = NULL;
+        gc_collect(&gc);
+
+        size_t reserved =
+            arena_capacity(&gc.active)
+            + arena_capacity(&gc.inactive)
+            + arena_capacity(&gc.nursery);
+        result = reserved <= config.max_heap_size;
+        goto cleanup;
+    }
+    gc.oom_handler = &handler;
+
+    // Keep every link alive until the heap is exhausted.
+    for (;;) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        link->next = head;
+        link->val = 0;
+        head = link;
+    }
+
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_stats_track_collections() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    GcLink* head = NULL;
+    GC_ROOT(&gc, &head);
+
+    size_t length = 64;
+    for (size_t i = 0; i < length; i++) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        link->next = head;
+        link->val = i;
+        head = link;
+    }
+
+    GcStats before = gc.stats;
+    size_t survivors = gc.stats.survivors[type_id];
+    gc_collect(&gc);
+    GcStats* after = &gc.stats;
+
+    if (before.bytes_allocated < length * sizeof(GcLink)) goto cleanup;
+    if (after->major_collections != before.major_collections + 1) goto cleanup;
+    if (after->survivors[type_id] != survivors + length) goto cleanup;
+    if (after->bytes_copied < before.bytes_copied + length * sizeof(GcLink)) {
+        goto cleanup;
+    }
+
+    size_t pauses = 0;
+    for (size_t i = 0; i < GC_PAUSE_BUCKET_COUNT; i++) {
+        pauses += after->pause_histogram[i];
+    }
+
+    result = pauses == after->major_collections + after->minor_collections
+        && after->heap_size <= after->peak_heap_size;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_large_objects_are_charged_for_their_block() {
+    GcConfig config;
+    gc_config_default(&config);
+    config.initial_size = 4096;
+    config.max_heap_size = NURSERY_SIZE + 2 * 64 * 1024;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t array_id = gc_add_type(
+        &gc,
+        alignof(GcArray),
+        gc_array_size,
+        gc_array_scan
+    );
+
+    // An object that fits the remaining room by itself doesn't fit once its
+    // header and padding are included.
+    gc_collect(&gc);
+    size_t room = config.max_heap_size - gc.stats.heap_size;
+    size_t size = room & ~(alignof(GcObject) - 1);
+
+    volatile bool refused = false;
+    jmp_buf handler;
+    if (setjmp(handler) == 0) {
+        gc.oom_handler = &handler;
+        gc_alloc(&gc, array_id, size);
+    } else {
+        refused = true;
+    }
+    gc.oom_handler = NULL;
+    if (!refused) goto cleanup;
+
+    size_t len = 4 * GC_LARGE_OBJECT_SIZE;
+    GcArray* large =
+        (GcArray*) gc_alloc(&gc, array_id, sizeof(GcArray) + len);
+    large->len = len;
+    size_t block_size = sizeof(GcLargeObject) + sizeof(GcArray) + len;
+
+    result = gc.large_size >= block_size
+        && gc.stats.large_object_size == gc.large_size
+        && gc.stats.heap_size <= config.max_heap_size;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_large_objects_are_not_moved() {
+    Gc gc;
+    if (!gc_init(&gc, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t array_id = gc_add_type(
+        &gc,
+        alignof(GcArray),
+        gc_array_size,
+        gc_array_scan
+    );
+    size_t link_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    size_t len = 4 * GC_LARGE_OBJECT_SIZE;
+    GcArray* large =
+        (GcArray*) gc_alloc(&gc, array_id, sizeof(GcArray) + len);
+    large->len = len;
+    large->val = 42;
+    memset((uint8_t*) (large + 1), 0xab, len);
+    GcArray* original = large;
+    GC_ROOT(&gc, &large);
+
+    // Surround the large object with small objects that are copied.
+    GcLink* head = (GcLink*) gc_alloc(&gc, link_id, sizeof(GcLink));
+    head->next = NULL;
+    head->val = 0;
+    GC_ROOT(&gc, &head);
+    for (size_t i = 1; i < 64; i++) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, link_id, sizeof(GcLink));
+        link->next = head;
+        link->val = i;
+        head = link;
+    }
+
+    size_t copied = gc.stats.bytes_copied;
+    gc_collect(&gc);
+    gc_collect(&gc);
+
+    if (large != original || large->val != 42) goto cleanup;
+    if (((uint8_t*) (large + 1))[len - 1] != 0xab) goto cleanup;
+    if (gc.stats.bytes_copied - copied >= len) goto cleanup;
+    if (gc.stats.large_object_size < len) goto cleanup;
+
+    GC_UNROOT(&gc, &large);
+    gc_collect(&gc);
+
+    result = gc.large_size == 0 && gc.large_objects == NULL;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+bool gc_parallel_collect_shared_chains() {
+    GcConfig config;
+    gc_config_default(&config);
+    config.threads = 4;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_id = gc_add_type(
+        &gc,
+        alignof(GcLink),
+        gc_link_size,
+        gc_link_scan
+    );
+
+    // Every chain ends in the same tail, so threads race to copy it.
+    size_t tail_length = 1024;
+    GcLink* tail = NULL;
+    GC_ROOT(&gc, &tail);
+    for (size_t i = 0; i < tail_length; i++) {
+        GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+        link->next = tail;
+        link->val = i;
+        tail = link;
+    }
+
+    GcLink* heads[16];
+    size_t length = 512;
+    for (size_t h = 0; h < countof(heads); h++) {
+        heads[h] = tail;
+        GC_ROOT(&gc, &heads[h]);
+
+        for (size_t i = 0; i < length; i++) {
+            GcLink* link = (GcLink*) gc_alloc(&gc, type_id, sizeof(GcLink));
+            link->next = heads[h];
+            link->val = tail_length + i;
+            heads[h] = link;
+        }
+    }
+
+    size_t live = countof(heads) * length + tail_length;
+    for (size_t collection = 0; collection < 4; collection++) {
+        size_t survivors = gc.stats.survivors[type_id];
+        gc_collect(&gc);
+
+        // Shared objects must only be copied once.
+        if (gc.stats.survivors[type_id] != survivors + live) goto cleanup;
+
+        for (size_t h = 0; h < countof(heads); h++) {
+            GcLink* link = heads[h];
+            for (size_t i = length; i > 0; i--) {
+                if (link->val != tail_length + i - 1) goto cleanup;
+                link = link->next;
+            }
+
+            if (link != tail) goto cleanup;
+        }
+
+        GcLink* link = tail;
+        for (size_t i = tail_length; i > 0; i--) {
+            if (link == NULL || link->val != i - 1) goto cleanup;
+            link = link->next;
+        }
+
+        if (link != NULL) goto cleanup;
+    }
+
+    result = true;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
+typedef struct GcBox GcBox;
+struct GcBox {
+    GcObject object;
+    GcBox* next;
+    size_t len;
+    size_t val;
+};
+
+size_t gc_box_size(GcObject* object) {
+    return sizeof(GcBox) + ((GcBox*) object)->len;
+}
+
+void gc_box_scan(Gc* gc, GcObject* object) {
+    GC_SCAN_FIELD(gc, ((GcBox*) object)->next);
+}
+
+// Checks the first `length` boxes of a chain built by
+// `gc_parallel_collect_mixed_objects`, and that `tail` follows them.
+static bool gc_box_chain_is_intact(
+    Gc* gc,
+    GcBox* box,
+    size_t length,
+    GcBox* tail
+) {
+    for (size_t i = length; i > 0; i--) {
+        if (box == NULL || box->val != i - 1) return false;
+
+        size_t align = gc->types[gc_object_type(&box->object)].align;
+        if ((uintptr_t) box % align != 0) return false;
+
+        uint8_t* payload = (uint8_t*) (box + 1);
+        for (size_t byte = 0; byte < box->len; byte++) {
+            if (payload[byte] != (uint8_t) box->val) return false;
+        }
+        box = box->next;
+    }
+    return box == tail;
+}
+
+bool gc_parallel_collect_mixed_objects() {
+    // Start small, so that to-space is sized by the parallel bound alone.
+    GcConfig config;
+    gc_config_default(&config);
+    config.initial_size = 4096;
+    config.threads = 4;
+
+    Gc gc;
+    if (!gc_init(&gc, &config)) {
+        return false;
+    }
+
+    bool result = false;
+
+    size_t type_ids[4];
+    for (size_t i = 0; i < countof(type_ids); i++) {
+        size_t align = i == 0 ? alignof(GcBox) : (size_t) 64 << (i - 1);
+        type_ids[i] = gc_add_type(&gc, align, gc_box_size, gc_box_scan);
+    }
+
+    // Sizes range up to the largest object that isn't a large object, so
+    // that buffers are retired with as much room left as possible. Every
+    // chain ends in the first one, so threads race to copy over-aligned
+    // objects.
+    GcBox* heads[8];
+    size_t length = 256;
+    uint64_t seed = 0x9e3779b97f4a7c15;
+    for (size_t h = 0; h < countof(heads); h++) {
+        heads[h] = h == 0 ? NULL : heads[0];
+        GC_ROOT(&gc, &heads[h]);
+
+        for (size_t i = 0; i < length; i++) {
+            seed = seed * 6364136223846793005 + 1442695040888963407;
+            size_t type = (seed >> 33) % countof(type_ids);
+            size_t align = gc.types[type_ids[type]].align;
+            size_t max_len =
+                GC_LARGE_OBJECT_SIZE - (align - 1) - sizeof(GcBox);
+            size_t len = i % 4 == 0 ? max_len : (seed >> 40) % max_len;
+
+            GcBox* box = (GcBox*) gc_alloc(
+                &gc,
+                type_ids[type],
+                sizeof(GcBox) + len
+            );
+            box->next = heads[h];
+            box->len = len;
+            box->val = i;
+            memset((uint8_t*) (box + 1), (uint8_t) i, len);
+            heads[h] = box;
+        }
+    }
+
+    for (size_t collection = 0; collection < 4; collection++) {
+        gc_collect(&gc);
+        for (size_t h = 0; h < countof(heads); h++) {
+            GcBox* tail = h == 0 ? NULL : heads[0];
+            if (!gc_box_chain_is_intact(&gc, heads[h], length, tail)) {
+                goto cleanup;
+            }
+        }
+    }
+
+    result = true;
+cleanup:
+    gc_free(&gc);
+    return result;
+}
+
 TestDefinition gc_tests[] = {
-    DEFINE_UNIT_TEST(gc_handle_failed_alloc_during_collect, 0),
+    DEFINE_UNIT_TEST(gc_size_to_space_for_over_aligned_objects, 0),
     DEFINE_UNIT_TEST(gc_support_redundant_rooting, 0),
+    DEFINE_UNIT_TEST(gc_frame_roots_objects, 0),
+    DEFINE_UNIT_TEST(gc_collect_long_chain, 0),
+    DEFINE_UNIT_TEST(gc_write_barrier_keeps_young_objects, 0),
+    DEFINE_UNIT_TEST(gc_heap_shrinks_after_spike, 0),
+    DEFINE_UNIT_TEST(gc_max_heap_size_is_enforced, 0),
+    DEFINE_UNIT_TEST(gc_stats_track_collections, 0),
+    DEFINE_UNIT_TEST(gc_large_objects_are_charged_for_their_block, 0),
+    DEFINE_UNIT_TEST(gc_large_objects_are_not_moved, 0),
+    DEFINE_UNIT_TEST(gc_parallel_collect_shared_chains, 0),
+    DEFINE_UNIT_TEST(gc_parallel_collect_mixed_objects, 0),
 };
 
 TestList gc_test_list = (TestList) {
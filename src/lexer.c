@@ -579,7 +579,7 @@ static bool lexer_lex_nothing() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8(""));
 
     bool result = false;
@@ -601,7 +601,7 @@ static bool lexer_lex_nil() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("()"));
 
     bool result = false;
@@ -628,7 +628,7 @@ static bool lexer_lex_numbers() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("1.0 .1 1. 1.2 +1.2 -1.2"));
 
     bool result = false;
@@ -667,7 +667,7 @@ static bool lexer_lex_strange_symbols() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("1.0. a\" a'1. .1.2 1+1.2 q-1.2"));
 
     bool result = false;
@@ -706,7 +706,7 @@ static bool lexer_lex_complex_escapes() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("\"\\u\" \"\\u{\" \"\\u{AV\" \"\\xA\""));
 
     bool result = false;
@@ -741,7 +741,7 @@ static bool lexer_lex_string_suffix() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("\"\"a"));
 
     bool result = false;
@@ -770,7 +770,7 @@ static bool lexer_lex_unterminated_string() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     lexer_init_s8(&lexer, s8("\"Hello World!\" (\"Game on!"));
 
     bool result = false;
@@ -802,7 +802,7 @@ static bool lexer_lex_utf8_error() {
     Vm vm;
     Lexer lexer;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     uint8_t bytes[] = { 0x88, 0x29, 0x0a };
 
     s8 input;
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,47 +30,167 @@ void drive(Vm* vm, Parser* parser) {
     }
 }
 
+static bool parse_size(const char* arg, size_t* size) {
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(arg, &end, 10);
+    if (errno != 0 || end == arg) return false;
+
+    unsigned long long multiplier = 1;
+    switch (*end) {
+        case 'k': case 'K': multiplier = 1024ULL; end += 1; break;
+        case 'm': case 'M': multiplier = 1024ULL * 1024; end += 1; break;
+        case 'g': case 'G': multiplier = 1024ULL * 1024 * 1024; end += 1; break;
+    }
+
+    if (*end != '\0') return false;
+    if (value > SIZE_MAX / multiplier) return false;
+
+    *size = (size_t) (value * multiplier);
+    return true;
+}
+
+static bool parse_double(const char* arg, double* value) {
+    char* end;
+    errno = 0;
+    *value = strtod(arg, &end);
+    return errno == 0 && end != arg && *end == '\0';
+}
+
+// Returns the value of `arg` if it is of the form `name=value`.
+static const char* option_value(const char* arg, const char* name) {
+    size_t name_len = strlen(name);
+    if (strncmp(arg, name, name_len) != 0) return NULL;
+    if (arg[name_len] != '=') return NULL;
+
+    return &arg[name_len + 1];
+}
+
+// Applies a `--name=value` heap option to `config`.
+static bool parse_heap_option(const char* arg, GcConfig* config) {
+    if (strcmp(arg, "--huge-pages") == 0) {
+        config->huge_pages = true;
+        return true;
+    }
+
+    const char* value;
+    if ((value = option_value(arg, "--initial-heap")) != NULL) {
+        return parse_size(value, &config->initial_size);
+    } else if ((value = option_value(arg, "--max-heap")) != NULL) {
+        return parse_size(value, &config->max_heap_size);
+    } else if ((value = option_value(arg, "--heap-growth")) != NULL) {
+        return parse_double(value, &config->growth_factor);
+    } else if ((value = option_value(arg, "--target-live-ratio")) != NULL) {
+        return parse_double(value, &config->target_live_ratio);
+    } else if ((value = option_value(arg, "--shrink-after")) != NULL) {
+        return parse_size(value, &config->shrink_after);
+    } else if ((value = option_value(arg, "--gc-threads")) != NULL) {
+        return parse_size(value, &config->threads);
+    }
+
+    return false;
+}
+
+static void print_usage(void) {
+    fprintf(
+        stderr,
+        "usage: lisp [options] [path]\n"
+        "options:\n"
+        "  --initial-heap=SIZE        initial size of each semispace\n"
+        "  --max-heap=SIZE            maximum heap size, 0 for no limit\n"
+        "  --heap-growth=FACTOR       factor by which the heap grows\n"
+        "  --target-live-ratio=RATIO  fraction of the heap kept live\n"
+        "  --shrink-after=COUNT       underused collections before shrinking\n"
+        "  --huge-pages               back the heap with huge pages\n"
+        "  --gc-threads=COUNT         threads used by full collections\n"
+        "  --gc-stats                 report gc statistics on exit\n"
+        "  --max-stack-depth=COUNT    frames allowed before evaluation stops\n"
+        "sizes may have a k, m, or g suffix\n"
+    );
+}
+
 int main(int argc, char* argv[]) {
     Vm vm;
     Parser parser;
 
-    if (argc == 1) {
-        if (!vm_init(&vm)) {
+    GcConfig config;
+    gc_config_default(&config);
+
+    bool print_gc_stats = false;
+    size_t max_stack_depth = VM_DEFAULT_MAX_STACK_DEPTH;
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char* value;
+        if (strcmp(argv[i], "--gc-stats") == 0) {
+            print_gc_stats = true;
+        } else if (
+            (value = option_value(argv[i], "--max-stack-depth")) != NULL
+        ) {
+            // Evaluation can't start without a frame to run in.
+            bool valid = parse_size(value, &max_stack_depth)
+                && max_stack_depth != 0;
+            if (!valid) {
+                fprintf(stderr, "invalid option \"%s\"\n", argv[i]);
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            if (!parse_heap_option(argv[i], &config)) {
+                fprintf(stderr, "invalid option \"%s\"\n", argv[i]);
+                print_usage();
+                return EXIT_FAILURE;
+            }
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!gc_config_is_valid(&config)) {
+        fprintf(stderr, "invalid heap configuration\n");
+        return EXIT_FAILURE;
+    }
+
+    if (path == NULL) {
+        if (!vm_init(&vm, &config)) {
             fprintf(stderr, "failed to initialize VM\n");
             return EXIT_FAILURE;
         }
+        vm.max_stack_depth = max_stack_depth;
         parser_init(&parser, stdin, stdout);
 
         drive(&vm, &parser);
+        if (print_gc_stats) gc_print_stats(&vm.gc, stderr);
 
         parser_free(&parser);
         vm_free(&vm);
-    } else if (argc == 2) {
-        FILE* file = fopen(argv[1], "rb");
+    } else {
+        FILE* file = fopen(path, "rb");
         if (file == NULL) {
             fprintf(
                 stderr,
                 "failed to open file \"%s\": %s\n",
-                argv[1],
+                path,
                 strerror(errno)
             );
             return EXIT_FAILURE;
         }
 
-        if (!vm_init(&vm)) {
+        if (!vm_init(&vm, &config)) {
             fprintf(stderr, "failed to initialize VM\n");
             return EXIT_FAILURE;
         }
+        vm.max_stack_depth = max_stack_depth;
         parser_init(&parser, file, NULL);
 
         drive(&vm, &parser);
+        if (print_gc_stats) gc_print_stats(&vm.gc, stderr);
 
         fclose(file);
         parser_free(&parser);
         vm_free(&vm);
-    } else {
-        fprintf(stderr, "usage: lisp [path]\n");
-        return EXIT_FAILURE;
     }
 
     return EXIT_SUCCESS;
@@ -7,7 +7,7 @@
 #include "parser.h"
 #include "vm.h"
 
-#define PARSE_ERROR_NODE_GC_TYPE_ID 4
+#define PARSE_ERROR_NODE_GC_TYPE_ID 8
 
 size_t parse_context_error_count(ParseContext context) {
     size_t count = 0;
@@ -41,9 +41,15 @@ void parse_context_add_error(
     new_error->length = length;
     new_error->next = NULL;
 
-    ParseErrorNode** current = context;
-    while (*current != NULL) current = &(*current)->next;
-    *current = new_error;
+    if (*context == NULL) {
+        *context = new_error;
+    } else {
+        ParseErrorNode* last = *context;
+        while (last->next != NULL) last = last->next;
+
+        last->next = new_error;
+        VM_WRITE_BARRIER(vm, last);
+    }
 
     VM_UNROOT(vm, context);
 }
@@ -93,29 +99,8 @@ static size_t parse_context_size(GcObject* object) {
     return sizeof(ParseErrorNode);
 }
 
-static void parse_context_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    ((ParseErrorNode*) new_object)->type = ((ParseErrorNode*) object)->type;
-    ((ParseErrorNode*) new_object)->index = ((ParseErrorNode*) object)->index;
-    ((ParseErrorNode*) new_object)->length =
-        ((ParseErrorNode*) object)->length;
-
-    ParseErrorNode* next = ((ParseErrorNode*) object)->next;
-    if (next == NULL) {
-        ((ParseErrorNode*) new_object)->next = NULL;
-    } else {
-        ((ParseErrorNode*) new_object)->next = (ParseErrorNode*)
-            gc_copy_object(
-                gc,
-                (GcObject*) next
-            );
-    }
-}
-
-static GcObject* parse_context_get_children(GcObject* object, GcObject* position) {
-    GcObject* child = (GcObject*) ((ParseErrorNode*) object)->next;
-
-    if (position == NULL) return child;
-    return NULL;
+static void parse_context_scan(Gc* gc, GcObject* object) {
+    GC_SCAN_FIELD(gc, ((ParseErrorNode*) object)->next);
 }
 
 void gc_add_parse_context(Gc* gc) {
@@ -123,8 +108,7 @@ void gc_add_parse_context(Gc* gc) {
         gc,
         alignof(ParseErrorNode),
         parse_context_size,
-        parse_context_copy,
-        parse_context_get_children
+        parse_context_scan
     );
 
     ASSERT(type_id == PARSE_ERROR_NODE_GC_TYPE_ID);
@@ -137,7 +121,7 @@ void gc_add_parse_context(Gc* gc) {
 
 static bool parse_context_chaining() {
     Vm vm;
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
 
     bool result = false;
 
@@ -176,7 +160,7 @@ cleanup:
 
 static bool parse_context_counting() {
     Vm vm;
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
 
     bool result = false;
 
@@ -388,6 +388,7 @@ static SExpr* parser_parse_list(
             current = base;
         } else {
             AS_CONS(current)->cdr = cons;
+            VM_WRITE_BARRIER(vm, current);
             current = AS_CONS(current)->cdr;
         }
     }
@@ -473,7 +474,7 @@ bool parser_parse_nil() {
     Vm vm;
     Parser parser;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     parser_init_s8(&parser, s8("()"));
 
     bool test_result = false;
@@ -496,7 +497,7 @@ bool parser_parse_double_nil() {
     Vm vm;
     Parser parser;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     parser_init_s8(&parser, s8("() ()"));
 
     bool test_result = false;
@@ -523,7 +524,7 @@ bool parser_parse_basic_symbols() {
     Vm vm;
     Parser parser;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     parser_init_s8(&parser, s8("news nil? string?"));
 
     bool test_result = false;
@@ -554,7 +555,7 @@ bool parser_parse_simple_list() {
     Vm vm;
     Parser parser;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     parser_init_s8(&parser, s8("(news)"));
 
     bool test_result = false;
@@ -577,7 +578,7 @@ bool parser_skip_right_parens() {
     Vm vm;
     Parser parser;
 
-    if (!vm_init(&vm)) return false;
+    if (!vm_init(&vm, NULL)) return false;
     parser_init_s8(&parser, s8(")))))) (news)"));
 
     bool test_result = false;
@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "resolve.h"
+#include "sexpr.h"
+#include "vm.h"
+
+typedef struct {
+    // The parameters of the function being resolved.
+    SExpr* params;
+    // The parameters rebound by a `let`, which must be looked up by name.
+    SExpr* rebound;
+} Resolver;
+
+typedef SExpr* (*ResolveFn)(Vm* vm, Resolver* resolver, SExpr* sexpr);
+
+static bool is_form(Vm* vm, SExpr* head, s8 name) {
+    return IS_SYMBOL(head) && head == vm_find_symbol(vm, name);
+}
+
+// Returns `true` if `sexpr` contains a `(let symbol ...)` form.
+static bool rebinds(SExpr* sexpr, SExpr* let, SExpr* symbol) {
+    while (!IS_NIL(sexpr) && IS_CONS(sexpr)) {
+        SExpr* head = EXTRACT_CAR(sexpr);
+        SExpr* tail = EXTRACT_CDR(sexpr);
+        if (head == let && !IS_NIL(tail) && IS_CONS(tail)) {
+            if (EXTRACT_CAR(tail) == symbol) return true;
+        }
+
+        if (rebinds(head, let, symbol)) return true;
+        sexpr = tail;
+    }
+
+    return false;
+}
+
+// Returns `true` if `symbol` names a parameter that can be resolved, storing
+// its slot in `*slot`.
+static bool resolve_slot(Resolver* resolver, SExpr* symbol, size_t* slot) {
+    bool found = false;
+
+    // Later parameters shadow earlier ones with the same name.
+    size_t index = 0;
+    SExpr* param = resolver->params;
+    while (!IS_NIL(param) && IS_CONS(param)) {
+        if (EXTRACT_CAR(param) == symbol) {
+            *slot = index;
+            found = true;
+        }
+
+        index += 1;
+        param = EXTRACT_CDR(param);
+    }
+
+    SExpr* rebound = resolver->rebound;
+    while (found && !IS_NIL(rebound)) {
+        if (EXTRACT_CAR(rebound) == symbol) found = false;
+        rebound = EXTRACT_CDR(rebound);
+    }
+
+    return found;
+}
+
+// Resolves each element of `list` after the first `skip`, copying the list
+// only up to the last element that changed.
+static SExpr* resolve_list(
+    Vm* vm,
+    Resolver* resolver,
+    SExpr* list,
+    size_t skip,
+    ResolveFn resolve
+) {
+    if (IS_NIL(list) || !IS_CONS(list)) return list;
+
+    SExpr* car = EXTRACT_CAR(list);
+    SExpr* cdr = NULL;
+    VM_FRAME_BEGIN(vm, &list, &car, &cdr);
+
+    if (skip == 0) {
+        car = resolve(vm, resolver, car);
+    } else {
+        skip -= 1;
+    }
+
+    cdr = resolve_list(vm, resolver, EXTRACT_CDR(list), skip, resolve);
+    if (car != EXTRACT_CAR(list) || cdr != EXTRACT_CDR(list)) {
+        list = vm_alloc_cons(vm, car, cdr);
+    }
+
+    VM_FRAME_END(vm);
+    return list;
+}
+
+static SExpr* resolve_expr(Vm* vm, Resolver* resolver, SExpr* sexpr);
+
+static SExpr* resolve_clause(Vm* vm, Resolver* resolver, SExpr* clause) {
+    return resolve_list(vm, resolver, clause, 0, resolve_expr);
+}
+
+static SExpr* resolve_expr(Vm* vm, Resolver* resolver, SExpr* sexpr) {
+    if (IS_SYMBOL(sexpr)) {
+        size_t slot;
+        if (!resolve_slot(resolver, sexpr, &slot)) return sexpr;
+
+        return vm_alloc_local(vm, sexpr, slot);
+    }
+
+    if (IS_NIL(sexpr) || !IS_CONS(sexpr)) return sexpr;
+
+    // The function position of a call is never looked up as a variable, and a
+    // lambda expression there has its own parameters.
+    SExpr* head = EXTRACT_CAR(sexpr);
+    if (!IS_NIL(head) && IS_CONS(head)) {
+        return resolve_list(vm, resolver, sexpr, 1, resolve_expr);
+    }
+
+    if (!IS_SYMBOL(head)) return sexpr;
+
+    // Quoted data and nested functions aren't part of this function's body.
+    bool opaque = is_form(vm, head, s8("quote"))
+        || is_form(vm, head, s8("lambda"))
+        || is_form(vm, head, s8("define"))
+        || is_form(vm, head, s8("function"));
+    if (opaque) return sexpr;
+
+    // The variable named by `let` and `set` isn't a reference.
+    if (is_form(vm, head, s8("let")) || is_form(vm, head, s8("set"))) {
+        return resolve_list(vm, resolver, sexpr, 2, resolve_expr);
+    }
+
+    if (is_form(vm, head, s8("cond"))) {
+        return resolve_list(vm, resolver, sexpr, 1, resolve_clause);
+    }
+
+    return resolve_list(vm, resolver, sexpr, 1, resolve_expr);
+}
+
+SExpr* resolve_locals(Vm* vm, SExpr* params, SExpr* body) {
+    Resolver resolver = { params, NIL };
+    SExpr* param = params;
+    VM_FRAME_BEGIN(vm, &resolver.params, &resolver.rebound, &body, &param);
+
+    // A `let` adds a binding that shadows the parameter for the rest of the
+    // call, so those parameters keep being looked up by name.
+    while (!IS_NIL(param) && IS_CONS(param)) {
+        SExpr* let = vm_find_symbol(vm, s8("let"));
+        SExpr* symbol = EXTRACT_CAR(param);
+        if (!IS_NIL(let) && rebinds(body, let, symbol)) {
+            resolver.rebound = vm_alloc_cons(vm, symbol, resolver.rebound);
+        }
+
+        param = EXTRACT_CDR(param);
+    }
+
+    body = resolve_expr(vm, &resolver, body);
+
+    VM_FRAME_END(vm);
+    return body;
+}
+
+#ifdef ENABLE_TESTS
+
+#include "parser.h"
+#include "test.h"
+
+static SExpr* resolve_test_parse(Vm* vm, s8 input) {
+    Parser parser;
+    parser_init_s8(&parser, input);
+
+    ParseResult result;
+    bool parsed = parser_next_sexpr(vm, &parser, &result);
+    parser_free(&parser);
+
+    return parsed && result.ok ? result.as.ok : NIL;
+}
+
+static bool resolve_test_is_local(SExpr* sexpr, s8 name, size_t slot) {
+    return IS_LOCAL(sexpr)
+        && AS_LOCAL(sexpr)->slot == slot
+        && s8_equals(EXTRACT_SYMBOL(AS_LOCAL(sexpr)->symbol), name);
+}
+
+bool resolve_locals_replaces_parameters() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    SExpr* params = NULL;
+    SExpr* body = NULL;
+    SExpr* resolved = NULL;
+    VM_ROOT(&vm, &params);
+    VM_ROOT(&vm, &body);
+    VM_ROOT(&vm, &resolved);
+
+    params = resolve_test_parse(&vm, s8("(a b a c)"));
+    body = resolve_test_parse(
+        &vm,
+        s8("(a (f a b) 'a (lambda (b) b) (cond (c a)) (let c b) c)")
+    );
+    resolved = resolve_locals(&vm, params, body);
+
+    // The call's head stays a symbol even though it names a parameter.
+    SExpr* form = resolved;
+    if (!IS_SYMBOL(EXTRACT_CAR(form))) goto cleanup;
+    form = EXTRACT_CDR(form);
+
+    // The last parameter with a name shadows the others.
+    SExpr* call = EXTRACT_CDR(EXTRACT_CAR(form));
+    if (!resolve_test_is_local(EXTRACT_CAR(call), s8("a"), 2)) goto cleanup;
+    call = EXTRACT_CDR(call);
+    if (!resolve_test_is_local(EXTRACT_CAR(call), s8("b"), 1)) goto cleanup;
+    form = EXTRACT_CDR(form);
+
+    // Quoted data and nested lambdas are left alone.
+    SExpr* body_form = EXTRACT_CDR(body);
+    if (EXTRACT_CAR(form) != EXTRACT_CAR(EXTRACT_CDR(body_form))) {
+        goto cleanup;
+    }
+    form = EXTRACT_CDR(form);
+    body_form = EXTRACT_CDR(EXTRACT_CDR(body_form));
+    if (EXTRACT_CAR(form) != EXTRACT_CAR(body_form)) goto cleanup;
+    form = EXTRACT_CDR(form);
+
+    // Both the test and the value of a `cond` clause are resolved, but `c` is
+    // rebound by the `let`.
+    SExpr* clause = EXTRACT_CAR(EXTRACT_CDR(EXTRACT_CAR(form)));
+    if (!IS_SYMBOL(EXTRACT_CAR(clause))) goto cleanup;
+    clause = EXTRACT_CDR(clause);
+    if (!resolve_test_is_local(EXTRACT_CAR(clause), s8("a"), 2)) goto cleanup;
+    form = EXTRACT_CDR(form);
+
+    SExpr* let = EXTRACT_CDR(EXTRACT_CAR(form));
+    if (!IS_SYMBOL(EXTRACT_CAR(let))) goto cleanup;
+    let = EXTRACT_CDR(let);
+    if (!resolve_test_is_local(EXTRACT_CAR(let), s8("b"), 1)) goto cleanup;
+    form = EXTRACT_CDR(form);
+
+    if (!IS_SYMBOL(EXTRACT_CAR(form))) goto cleanup;
+
+    // Bodies without parameter references aren't copied.
+    params = resolve_test_parse(&vm, s8("(z)"));
+    if (resolve_locals(&vm, params, body) != body) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+TestDefinition resolve_tests[] = {
+    DEFINE_UNIT_TEST(resolve_locals_replaces_parameters, 0),
+};
+
+TestList resolve_test_list = (TestList) {
+    resolve_tests,
+    countof(resolve_tests)
+};
+
+#endif
@@ -27,6 +27,23 @@ bool s8_equals(s8 a, s8 b) {
     return true;
 }
 
+size_t s8_hash(s8 s) {
+#if SIZE_MAX > UINT32_MAX
+    size_t hash = 14695981039346656037u;
+    size_t prime = 1099511628211u;
+#else
+    size_t hash = 2166136261u;
+    size_t prime = 16777619u;
+#endif
+
+    for (size_t index = 0; index < s.len; index++) {
+        hash ^= s.ptr[index];
+        hash *= prime;
+    }
+
+    return hash;
+}
+
 void s8_copy(s8 to, s8 from) {
     ASSERT(to.len == from.len, "s8 length must be equal");
     for (size_t index = 0; index < to.len; index++) {
@@ -9,12 +9,17 @@
 
 SExprType sexpr_extract_type(const SExpr* sexpr) {
     if (IS_NIL(sexpr)) return SEXPR_CONS;
+    if (IS_IMMEDIATE_NUMBER(sexpr)) return SEXPR_NUMBER;
     size_t type_id = gc_object_type((GcObject*) sexpr);
     ASSERT(
         type_id == SEXPR_SYMBOL
         || type_id == SEXPR_STRING
         || type_id == SEXPR_NUMBER
-        || type_id == SEXPR_CONS,
+        || type_id == SEXPR_CONS
+        || type_id == SEXPR_LOCAL
+        || type_id == SEXPR_CODE
+        || type_id == SEXPR_CLOSURE
+        || type_id == SEXPR_VECTOR,
         "invalid type id associated with sexpr"
     );
 
@@ -35,11 +40,15 @@ s8 sexpr_s8(const SExpr* sexpr) {
             s.len = ((SExprSymbol*) sexpr)->len;
             return s;
         case SEXPR_STRING:
-            s.ptr = ((SExprSymbol*) sexpr)->bytes;
-            s.len = ((SExprSymbol*) sexpr)->len;
+            s.ptr = ((SExprString*) sexpr)->bytes;
+            s.len = ((SExprString*) sexpr)->len;
             return s;
         case SEXPR_NUMBER:
         case SEXPR_CONS:
+        case SEXPR_LOCAL:
+        case SEXPR_CODE:
+        case SEXPR_CLOSURE:
+        case SEXPR_VECTOR:
             break;
     }
 
@@ -88,6 +97,29 @@ void sexpr_print(const SExpr* sexpr) {
                 sexpr = EXTRACT_CDR(sexpr);
             }
 
+            printf(")");
+            break;
+        case SEXPR_LOCAL:
+            sexpr_print(AS_LOCAL(sexpr)->symbol);
+            break;
+        case SEXPR_CODE:
+            sexpr_print(AS_CODE(sexpr)->source);
+            break;
+        case SEXPR_CLOSURE:
+            printf("('function ");
+            sexpr_print(AS_CLOSURE(sexpr)->id);
+            printf(" ");
+            sexpr_print(AS_CLOSURE(sexpr)->params);
+            printf(" ");
+            sexpr_print(AS_CLOSURE(sexpr)->body);
+            printf(")");
+            break;
+        case SEXPR_VECTOR:
+            printf("#(");
+            for (size_t i = 0; i < AS_VECTOR(sexpr)->len; i++) {
+                if (i != 0) printf(" ");
+                sexpr_print(AS_VECTOR(sexpr)->items[i]);
+            }
             printf(")");
             break;
     }
@@ -125,11 +157,27 @@ void sexpr_print_raw(const SExpr* sexpr, size_t tab_count) {
         case SEXPR_CONS:
             printf("type: CONS\n");
             break;
+        case SEXPR_LOCAL:
+            printf("type: LOCAL\n");
+            break;
+        case SEXPR_CODE:
+            printf("type: CODE\n");
+            break;
+        case SEXPR_CLOSURE:
+            printf("type: CLOSURE\n");
+            break;
+        case SEXPR_VECTOR:
+            printf("type: VECTOR\n");
+            break;
     }
 
-    // Forward pointer
+    // Header
     print_tabs(tab_count + 1);
-    printf("forward_ptr: %p\n", sexpr->object.forward_ptr);
+    if (IS_IMMEDIATE_NUMBER(sexpr)) {
+        printf("header: immediate\n");
+    } else {
+        printf("header: %#zx\n", sexpr->object.header);
+    }
 
     // Type specific information
     print_tabs(tab_count + 1);
@@ -154,6 +202,37 @@ void sexpr_print_raw(const SExpr* sexpr, size_t tab_count) {
             print_tabs(tab_count + 1);
             printf("cdr: %p ", EXTRACT_CDR(sexpr));
             sexpr_print_raw(EXTRACT_CDR(sexpr), tab_count + 1);
+            break;
+        case SEXPR_LOCAL:
+            printf("slot: %zu\n", AS_LOCAL(sexpr)->slot);
+
+            print_tabs(tab_count + 1);
+            printf("symbol: ");
+            sexpr_print_raw(AS_LOCAL(sexpr)->symbol, tab_count + 1);
+            break;
+        case SEXPR_CODE:
+            printf("length: %zu\n", AS_CODE(sexpr)->length);
+
+            print_tabs(tab_count + 1);
+            printf("source: ");
+            sexpr_print_raw(AS_CODE(sexpr)->source, tab_count + 1);
+            break;
+        case SEXPR_CLOSURE:
+            printf("arity: %zu\n", AS_CLOSURE(sexpr)->arity);
+
+            print_tabs(tab_count + 1);
+            printf("id: ");
+            sexpr_print_raw(AS_CLOSURE(sexpr)->id, tab_count + 1);
+            break;
+        case SEXPR_VECTOR:
+            printf("len: %zu", AS_VECTOR(sexpr)->len);
+            for (size_t i = 0; i < AS_VECTOR(sexpr)->len; i++) {
+                printf("\n");
+                print_tabs(tab_count + 1);
+                printf("%zu: ", i);
+                sexpr_print_raw(AS_VECTOR(sexpr)->items[i], tab_count + 1);
+            }
+            break;
     }
     printf("\n");
     print_tabs(tab_count);
@@ -164,71 +243,70 @@ static size_t sexpr_symbol_size(GcObject* object) {
     return offsetof(SExprSymbol, bytes) + AS_SYMBOL(object)->len;
 }
 
-static void sexpr_symbol_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    AS_SYMBOL(new_object)->len = AS_SYMBOL(object)->len;
-    s8_copy(EXTRACT_SYMBOL(new_object), EXTRACT_SYMBOL(object));
+static size_t sexpr_string_size(GcObject* object) {
+    return offsetof(SExprString, bytes) + AS_STRING(object)->len;
 }
 
-static GcObject* sexpr_symbol_get_children(GcObject* object, GcObject* position) {
-    return NULL;
+static size_t sexpr_number_size(GcObject* object) {
+    return sizeof(SExprNumber);
 }
 
-static size_t sexpr_string_size(GcObject* object) {
-    return offsetof(SExprString, bytes) + AS_STRING(object)->len;
+static size_t sexpr_cons_size(GcObject* object) {
+    return sizeof(SExprCons);
 }
 
-static void sexpr_string_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    AS_STRING(new_object)->len = AS_STRING(object)->len;
-    s8_copy(EXTRACT_STRING(new_object), EXTRACT_STRING(object));
+static size_t sexpr_local_size(GcObject* object) {
+    return sizeof(SExprLocal);
 }
 
-static GcObject* sexpr_string_get_children(GcObject* object, GcObject* position) {
-    return NULL;
+static size_t sexpr_code_size(GcObject* object) {
+    SExprCode* code = AS_CODE(object);
+    return offsetof(SExprCode, constants)
+        + code->constant_count * sizeof(SExpr*)
+        + code->length;
 }
 
-static size_t sexpr_number_size(GcObject* object) {
-    return sizeof(SExprNumber);
+static size_t sexpr_closure_size(GcObject* object) {
+    return sizeof(SExprClosure);
 }
 
-static void sexpr_number_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    AS_NUMBER(new_object)->number = EXTRACT_NUMBER(object);
+static size_t sexpr_vector_size(GcObject* object) {
+    return offsetof(SExprVector, items)
+        + AS_VECTOR(object)->len * sizeof(SExpr*);
 }
 
-static GcObject* sexpr_number_get_children(GcObject* object, GcObject* position) {
-    return NULL;
+static void sexpr_scan_leaf(Gc* gc, GcObject* object) {}
+
+static void sexpr_cons_scan(Gc* gc, GcObject* object) {
+    GC_SCAN_FIELD(gc, AS_CONS(object)->car);
+    GC_SCAN_FIELD(gc, AS_CONS(object)->cdr);
 }
 
-static size_t sexpr_cons_size(GcObject* object) {
-    return sizeof(SExprCons);
+static void sexpr_local_scan(Gc* gc, GcObject* object) {
+    GC_SCAN_FIELD(gc, AS_LOCAL(object)->symbol);
 }
 
-static void sexpr_cons_copy(Gc* gc, GcObject* object, GcObject* new_object) {
-    if (!IS_NIL(EXTRACT_CAR(object))) {
-        AS_CONS(new_object)->car =
-            (SExpr*) gc_copy_object(gc, (GcObject*) EXTRACT_CAR(object));
-    } else {
-        AS_CONS(new_object)->car = NIL;
+static void sexpr_code_scan(Gc* gc, GcObject* object) {
+    SExprCode* code = AS_CODE(object);
+    GC_SCAN_FIELD(gc, code->source);
+    GC_SCAN_FIELD(gc, code->params);
+    for (size_t i = 0; i < code->constant_count; i++) {
+        GC_SCAN_FIELD(gc, code->constants[i]);
     }
+}
 
-    if (!IS_NIL(EXTRACT_CDR(object))) {
-        AS_CONS(new_object)->cdr =
-            (SExpr*) gc_copy_object(gc, (GcObject*) EXTRACT_CDR(object));
-    } else {
-        AS_CONS(new_object)->cdr = NIL;
-    }
+static void sexpr_closure_scan(Gc* gc, GcObject* object) {
+    SExprClosure* closure = AS_CLOSURE(object);
+    GC_SCAN_FIELD(gc, closure->id);
+    GC_SCAN_FIELD(gc, closure->params);
+    GC_SCAN_FIELD(gc, closure->body);
 }
 
-static GcObject* sexpr_cons_get_children(GcObject* object, GcObject* position) {
-    GcObject* car = (GcObject*) EXTRACT_CAR(object);
-    GcObject* cdr = (GcObject*) EXTRACT_CDR(object);
-    if (position == NULL) {
-        if (car != NULL) return car;
-        if (cdr != NULL) return cdr;
-    } else if (position == car) {
-        if (cdr != NULL) return cdr;
+static void sexpr_vector_scan(Gc* gc, GcObject* object) {
+    SExprVector* vector = AS_VECTOR(object);
+    for (size_t i = 0; i < vector->len; i++) {
+        GC_SCAN_FIELD(gc, vector->items[i]);
     }
-    
-    return NULL;
 }
 
 void gc_add_sexpr(Gc* gc) {
@@ -236,31 +314,55 @@ void gc_add_sexpr(Gc* gc) {
         gc,
         alignof(SExprSymbol),
         sexpr_symbol_size,
-        sexpr_symbol_copy,
-        sexpr_symbol_get_children
+        sexpr_scan_leaf
     );
 
     gc_add_type(
         gc,
         alignof(SExprString),
         sexpr_string_size,
-        sexpr_string_copy,
-        sexpr_string_get_children
+        sexpr_scan_leaf
     );
 
     gc_add_type(
         gc,
         alignof(SExprNumber),
         sexpr_number_size,
-        sexpr_number_copy,
-        sexpr_number_get_children
+        sexpr_scan_leaf
     );
 
     gc_add_type(
         gc,
         alignof(SExprCons),
         sexpr_cons_size,
-        sexpr_cons_copy,
-        sexpr_cons_get_children
+        sexpr_cons_scan
+    );
+
+    gc_add_type(
+        gc,
+        alignof(SExprLocal),
+        sexpr_local_size,
+        sexpr_local_scan
+    );
+
+    gc_add_type(
+        gc,
+        alignof(SExprCode),
+        sexpr_code_size,
+        sexpr_code_scan
+    );
+
+    gc_add_type(
+        gc,
+        alignof(SExprClosure),
+        sexpr_closure_size,
+        sexpr_closure_scan
+    );
+
+    gc_add_type(
+        gc,
+        alignof(SExprVector),
+        sexpr_vector_size,
+        sexpr_vector_scan
     );
 }
@@ -5,12 +5,15 @@
 
 #include "arena.h"
 #include "common.h"
+#include "compiler.h"
 #include "eval-context.h"
 #include "eval.h"
+#include "gc-workers.h"
 #include "gc.h"
 #include "lexer.h"
 #include "parse-context.h"
 #include "parser.h"
+#include "resolve.h"
 #include "s8.h"
 #include "sexpr.h"
 #include "test.h"
@@ -33,12 +36,15 @@ int test_definition_compare(const void* obj_0, const void* obj_1) {
 TestList acquire_unit_tests() {
     TestList unit_test_lists[] = {
         arena_test_list,
+        compiler_test_list,
         eval_context_test_list,
         eval_test_list,
         gc_test_list,
+        gc_workers_test_list,
         lexer_test_list,
         parse_context_test_list,
         parser_test_list,
+        resolve_test_list,
         s8_test_list,
         vm_test_list,
     };
@@ -225,6 +231,29 @@ bool sexpr_eq(SExpr* a, SExpr* b) {
             return IS_CONS(b)
                 && sexpr_eq(EXTRACT_CAR(a), EXTRACT_CAR(b))
                 && sexpr_eq(EXTRACT_CDR(a), EXTRACT_CDR(b));
+        case SEXPR_LOCAL:
+            return IS_LOCAL(b)
+                && AS_LOCAL(a)->slot == AS_LOCAL(b)->slot
+                && sexpr_eq(AS_LOCAL(a)->symbol, AS_LOCAL(b)->symbol);
+        case SEXPR_CODE:
+            return IS_CODE(b)
+                && sexpr_eq(AS_CODE(a)->source, AS_CODE(b)->source);
+        case SEXPR_CLOSURE:
+            return IS_CLOSURE(b)
+                && sexpr_eq(AS_CLOSURE(a)->id, AS_CLOSURE(b)->id)
+                && sexpr_eq(AS_CLOSURE(a)->params, AS_CLOSURE(b)->params)
+                && sexpr_eq(AS_CLOSURE(a)->body, AS_CLOSURE(b)->body);
+        case SEXPR_VECTOR:
+            if (!IS_VECTOR(b) || AS_VECTOR(a)->len != AS_VECTOR(b)->len) {
+                return false;
+            }
+
+            for (size_t i = 0; i < AS_VECTOR(a)->len; i++) {
+                if (!sexpr_eq(AS_VECTOR(a)->items[i], AS_VECTOR(b)->items[i])) {
+                    return false;
+                }
+            }
+            return true;
     }
 
     UNREACHABLE();
@@ -341,7 +370,7 @@ int main() {
             result = test.test.unit_test();
         } else {
             Vm vm;
-            if (!vm_init(&vm)) {
+            if (!vm_init(&vm, NULL)) {
                 fprintf(stderr, "vm initialization failed\n");
                 exit(EXIT_FAILURE);
             }
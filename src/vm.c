@@ -1,54 +1,322 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 
+#include "builtin.h"
 #include "common.h"
 #include "eval-context.h"
+#include "eval-impl.h"
 #include "gc.h"
 #include "parse-context.h"
 #include "sexpr.h"
 #include "vm.h"
 
-bool vm_init(Vm* vm) {
-    if (!gc_init(&vm->gc)) {
+#define SYMBOL_TABLE_TYPE_ID 11
+#define SYMBOL_TABLE_INITIAL_CAPACITY 256
+#define ENV_TABLE_TYPE_ID 12
+#define ENV_TABLE_INITIAL_CAPACITY 64
+
+static void gc_add_symbol_table(Gc* gc);
+static SymbolTable* symbol_table_alloc(Vm* vm, size_t capacity);
+static void gc_add_env_table(Gc* gc);
+static EnvTable* env_table_alloc(Vm* vm, size_t capacity);
+
+// Evaluation may use half of the native stack, which leaves room for the
+// frames below the VM and for builtins that recurse without a frame.
+static size_t vm_native_stack_limit(void) {
+    size_t size = VM_DEFAULT_NATIVE_STACK_SIZE;
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_STACK, &limit) == 0) {
+        if (limit.rlim_cur != RLIM_INFINITY) size = (size_t) limit.rlim_cur;
+    }
+
+    return size / 2;
+}
+
+static VmValueChunk* vm_value_chunk_alloc(size_t capacity) {
+    size_t slot_size = sizeof(SExpr*) + sizeof(void*);
+    if (capacity > (SIZE_MAX - sizeof(VmValueChunk)) / slot_size) {
+        fprintf(stderr, "memory allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    VmValueChunk* chunk =
+        (VmValueChunk*) malloc(sizeof(VmValueChunk) + capacity * slot_size);
+    if (chunk == NULL) {
+        fprintf(stderr, "memory allocation error\n");
+        exit(EXIT_FAILURE);
+    }
+
+    chunk->prev = NULL;
+    chunk->base = 0;
+    chunk->count = 0;
+    chunk->capacity = capacity;
+    chunk->slots = (void**) &chunk->values[capacity];
+    for (size_t i = 0; i < capacity; i++) {
+        chunk->slots[i] = &chunk->values[i];
+    }
+
+    return chunk;
+}
+
+bool vm_init(Vm* vm, const GcConfig* config) {
+    if (!gc_init(&vm->gc, config)) {
         return false;
     }
 
     gc_add_sexpr(&vm->gc);
     gc_add_parse_context(&vm->gc);
     gc_add_eval_context(&vm->gc);
-
-    env_init(vm, &vm->vars);
-    VM_ROOT(vm, &vm->vars.list);
-
-    env_init(vm, &vm->funcs);
-    VM_ROOT(vm, &vm->funcs.list);
+    gc_add_symbol_table(&vm->gc);
+    gc_add_env_table(&vm->gc);
+
+    vm->max_stack_depth = VM_DEFAULT_MAX_STACK_DEPTH;
+
+    char base;
+    vm->native_stack_base = (uintptr_t) &base;
+    vm->native_stack_limit = vm_native_stack_limit();
+
+    vm->values = vm_value_chunk_alloc(VM_VALUE_CHUNK_SIZE);
+    vm->spare_values = NULL;
+
+    vm->symbols = NULL;
+    VM_ROOT(vm, &vm->symbols);
+    vm->symbols = symbol_table_alloc(vm, SYMBOL_TABLE_INITIAL_CAPACITY);
+
+    vm->t_symbol = NULL;
+    vm->lambda_symbol = NULL;
+    vm->begin_symbol = NULL;
+    VM_ROOT(vm, &vm->t_symbol);
+    VM_ROOT(vm, &vm->lambda_symbol);
+    VM_ROOT(vm, &vm->begin_symbol);
+    vm->t_symbol = vm_alloc_symbol(vm, s8("t"));
+    vm->lambda_symbol = vm_alloc_symbol(vm, s8("lambda"));
+    vm->begin_symbol = vm_alloc_symbol(vm, s8("begin"));
+
+    vm->vars = NULL;
+    VM_ROOT(vm, &vm->vars);
+    vm->vars = env_table_alloc(vm, ENV_TABLE_INITIAL_CAPACITY);
+
+    vm->funcs = NULL;
+    VM_ROOT(vm, &vm->funcs);
+    vm->funcs = env_table_alloc(vm, ENV_TABLE_INITIAL_CAPACITY);
+    vm->funcs_epoch = 0;
     return true;
 }
 
 void vm_free(Vm* vm) {
-    VM_UNROOT(vm, &vm->funcs.list);
-    VM_UNROOT(vm, &vm->vars.list);
-
-    env_free(&vm->funcs);
-    env_free(&vm->vars);
+    VM_UNROOT(vm, &vm->funcs);
+    VM_UNROOT(vm, &vm->vars);
+    VM_UNROOT(vm, &vm->begin_symbol);
+    VM_UNROOT(vm, &vm->lambda_symbol);
+    VM_UNROOT(vm, &vm->t_symbol);
+    VM_UNROOT(vm, &vm->symbols);
+    vm->funcs = NULL;
+    vm->vars = NULL;
+    vm->t_symbol = NULL;
+    vm->lambda_symbol = NULL;
+    vm->begin_symbol = NULL;
+    vm->symbols = NULL;
+
+    while (vm->values != NULL) {
+        VmValueChunk* prev = vm->values->prev;
+        free(vm->values);
+        vm->values = prev;
+    }
+    free(vm->spare_values);
+    vm->spare_values = NULL;
 
     gc_free(&vm->gc);
 }
 
-SExpr* vm_alloc_symbol(Vm* vm, s8 symbol) {
-    SExpr* sym = vm_alloc_symbol_with_length(vm, symbol.len);
-    s8_copy(EXTRACT_SYMBOL(sym), symbol);
-    return sym;
+// Drops the chunk on top of the value stack, keeping it as the spare.
+static void vm_pop_value_chunk(Vm* vm) {
+    VmValueChunk* chunk = vm->values;
+    vm->values = chunk->prev;
+
+    free(vm->spare_values);
+    vm->spare_values = chunk;
 }
 
-SExpr* vm_alloc_symbol_with_length(Vm* vm, size_t len) {
-    size_t total_size = offsetof(SExprSymbol, bytes) + len;
+SExpr** vm_push_values(Vm* vm, GcFrame* frame, size_t count) {
+    // The values of a push must be contiguous, so a push that doesn't fit
+    // starts a new chunk.
+    VmValueChunk* chunk = vm->values;
+    if (count > chunk->capacity - chunk->count) {
+        VmValueChunk* next = vm->spare_values;
+        vm->spare_values = NULL;
+        if (next == NULL || next->capacity < count) {
+            free(next);
+            size_t capacity =
+                count > VM_VALUE_CHUNK_SIZE ? count : VM_VALUE_CHUNK_SIZE;
+            next = vm_value_chunk_alloc(capacity);
+        }
+
+        next->prev = chunk;
+        next->base = chunk->base + chunk->count;
+        next->count = 0;
+        vm->values = next;
+        chunk = next;
+    }
+
+    SExpr** values = &chunk->values[chunk->count];
+    for (size_t i = 0; i < count; i++) {
+        values[i] = NIL;
+    }
+
+    frame->prev = vm->gc.frames;
+    frame->count = count;
+    frame->slots = &chunk->slots[chunk->count];
+    vm->gc.frames = frame;
+
+    chunk->count += count;
+    return values;
+}
+
+void vm_pop_values(Vm* vm, GcFrame* frame) {
+    ASSERT(vm->gc.frames == frame, "gc frames must be ended in order");
+    vm->gc.frames = frame->prev;
+
+    VmValueChunk* chunk = vm->values;
+    ASSERT(
+        frame->count <= chunk->count
+            && frame->slots == &chunk->slots[chunk->count - frame->count],
+        "values must be popped in order"
+    );
+    chunk->count -= frame->count;
+
+    if (chunk->count == 0 && chunk->prev != NULL) {
+        vm_pop_value_chunk(vm);
+    }
+}
+
+size_t vm_value_count(const Vm* vm) {
+    return vm->values->base + vm->values->count;
+}
+
+void vm_truncate_values(Vm* vm, size_t count) {
+    while (vm->values->prev != NULL && vm->values->base >= count) {
+        vm_pop_value_chunk(vm);
+    }
+
+    ASSERT(count <= vm_value_count(vm), "values can't be pushed by truncation");
+    vm->values->count = count - vm->values->base;
+}
+
+static size_t symbol_table_size(GcObject* object) {
+    return offsetof(SymbolTable, symbols)
+        + ((SymbolTable*) object)->capacity * sizeof(SExpr*);
+}
+
+static void symbol_table_scan(Gc* gc, GcObject* object) {
+    SymbolTable* table = (SymbolTable*) object;
+    for (size_t i = 0; i < table->capacity; i++) {
+        GC_SCAN_FIELD(gc, table->symbols[i]);
+    }
+}
+
+static void gc_add_symbol_table(Gc* gc) {
+    size_t type_id = gc_add_type(
+        gc,
+        alignof(SymbolTable),
+        symbol_table_size,
+        symbol_table_scan
+    );
+
+    ASSERT(type_id == SYMBOL_TABLE_TYPE_ID);
+}
+
+static SymbolTable* symbol_table_alloc(Vm* vm, size_t capacity) {
+    SymbolTable* table = (SymbolTable*) gc_alloc(
+        &vm->gc,
+        SYMBOL_TABLE_TYPE_ID,
+        offsetof(SymbolTable, symbols) + capacity * sizeof(SExpr*)
+    );
+
+    table->count = 0;
+    table->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        table->symbols[i] = NIL;
+    }
+
+    return table;
+}
+
+// Returns the slot holding the symbol named `name`, or the empty slot where it
+// should be inserted. The slot is only valid until the next allocation.
+static SExpr** symbol_table_slot(SymbolTable* table, s8 name, size_t hash) {
+    size_t mask = table->capacity - 1;
+    size_t index = hash & mask;
+
+    while (table->symbols[index] != NIL) {
+        SExpr* symbol = table->symbols[index];
+        if (AS_SYMBOL(symbol)->hash == hash
+            && s8_equals(EXTRACT_SYMBOL(symbol), name)
+        ) {
+            break;
+        }
+
+        index = (index + 1) & mask;
+    }
+
+    return &table->symbols[index];
+}
+
+static void symbol_table_grow(Vm* vm) {
+    SymbolTable* table = symbol_table_alloc(vm, vm->symbols->capacity * 2);
+    SymbolTable* old = vm->symbols;
+
+    // Every name is already unique, so each symbol only needs an empty slot.
+    size_t mask = table->capacity - 1;
+    for (size_t i = 0; i < old->capacity; i++) {
+        SExpr* symbol = old->symbols[i];
+        if (symbol == NIL) continue;
+
+        size_t index = AS_SYMBOL(symbol)->hash & mask;
+        while (table->symbols[index] != NIL) {
+            index = (index + 1) & mask;
+        }
+
+        table->symbols[index] = symbol;
+    }
+
+    table->count = old->count;
+    VM_WRITE_BARRIER(vm, table);
+    vm->symbols = table;
+}
+
+SExpr* vm_alloc_symbol(Vm* vm, s8 symbol) {
+    size_t hash = s8_hash(symbol);
+    SExpr* existing = *symbol_table_slot(vm->symbols, symbol, hash);
+    if (existing != NIL) {
+        return existing;
+    }
+
+    // Keep the table at most half full so that probe sequences stay short.
+    if ((vm->symbols->count + 1) * 2 > vm->symbols->capacity) {
+        symbol_table_grow(vm);
+    }
+
+    size_t total_size = offsetof(SExprSymbol, bytes) + symbol.len;
     SExpr* sym = (SExpr*) gc_alloc(&vm->gc, SEXPR_SYMBOL, total_size);
 
-    AS_SYMBOL(sym)->len = len;
+    AS_SYMBOL(sym)->hash = hash;
+    AS_SYMBOL(sym)->builtin = find_builtin(symbol);
+    AS_SYMBOL(sym)->len = symbol.len;
+    s8_copy(EXTRACT_SYMBOL(sym), symbol);
+
+    // The allocation may have moved the table.
+    *symbol_table_slot(vm->symbols, symbol, hash) = sym;
+    vm->symbols->count += 1;
+    VM_WRITE_BARRIER(vm, vm->symbols);
     return sym;
 }
 
+SExpr* vm_find_symbol(Vm* vm, s8 symbol) {
+    return *symbol_table_slot(vm->symbols, symbol, s8_hash(symbol));
+}
+
 SExpr* vm_alloc_string(Vm* vm, s8 string) {
     SExpr* str = vm_alloc_string_with_length(vm, string.len);
     s8_copy(EXTRACT_STRING(str), string);
@@ -64,6 +332,11 @@ SExpr* vm_alloc_string_with_length(Vm* vm, size_t len) {
 }
 
 SExpr* vm_alloc_number(Vm* vm, double number) {
+#ifdef SEXPR_IMMEDIATE_NUMBERS
+    SExpr* immediate;
+    if (sexpr_encode_number(number, &immediate)) return immediate;
+#endif
+
     SExpr* num = (SExpr*) gc_alloc(&vm->gc, SEXPR_NUMBER, sizeof(SExprNumber));
 
     AS_NUMBER(num)->number = number;
@@ -71,53 +344,469 @@ SExpr* vm_alloc_number(Vm* vm, double number) {
 }
 
 SExpr* vm_alloc_cons(Vm* vm, SExpr* car, SExpr* cdr) {
-    VM_ROOT(vm, &car);
-    VM_ROOT(vm, &cdr);
-
+    VM_FRAME_BEGIN(vm, &car, &cdr);
     SExpr* cons = (SExpr*) gc_alloc(&vm->gc, SEXPR_CONS, sizeof(SExprCons));
-
-    VM_UNROOT(vm, &cdr);
-    VM_UNROOT(vm, &car);
+    VM_FRAME_END(vm);
 
     AS_CONS(cons)->car = car;
     AS_CONS(cons)->cdr = cdr;
     return cons;
 }
 
+SExpr* vm_alloc_local(Vm* vm, SExpr* symbol, size_t slot) {
+    VM_FRAME_BEGIN(vm, &symbol);
+    SExpr* local = (SExpr*) gc_alloc(&vm->gc, SEXPR_LOCAL, sizeof(SExprLocal));
+    VM_FRAME_END(vm);
+
+    AS_LOCAL(local)->symbol = symbol;
+    AS_LOCAL(local)->slot = slot;
+    return local;
+}
+
+SExpr* vm_alloc_closure(Vm* vm, SExpr* id, SExpr* params, SExpr* body) {
+    VM_FRAME_BEGIN(vm, &id, &params, &body);
+    SExpr* closure =
+        (SExpr*) gc_alloc(&vm->gc, SEXPR_CLOSURE, sizeof(SExprClosure));
+    VM_FRAME_END(vm);
+
+    size_t arity = 0;
+    for (SExpr* param = params; !IS_NIL(param); param = EXTRACT_CDR(param)) {
+        arity += 1;
+    }
+
+    AS_CLOSURE(closure)->id = id;
+    AS_CLOSURE(closure)->params = params;
+    AS_CLOSURE(closure)->body = body;
+    AS_CLOSURE(closure)->arity = arity;
+    return closure;
+}
+
+SExpr* vm_alloc_vector(Vm* vm, size_t len, SExpr* fill) {
+    VM_FRAME_BEGIN(vm, &fill);
+    SExpr* vector = (SExpr*) gc_alloc(
+        &vm->gc,
+        SEXPR_VECTOR,
+        offsetof(SExprVector, items) + len * sizeof(SExpr*)
+    );
+    VM_FRAME_END(vm);
+
+    AS_VECTOR(vector)->len = len;
+    for (size_t i = 0; i < len; i++) {
+        AS_VECTOR(vector)->items[i] = fill;
+    }
+    return vector;
+}
+
+SExpr* vm_alloc_code(
+    Vm* vm,
+    SExpr* source,
+    SExpr* params,
+    size_t constant_count,
+    size_t length
+) {
+    VM_FRAME_BEGIN(vm, &source, &params);
+    SExpr* code = (SExpr*) gc_alloc(
+        &vm->gc,
+        SEXPR_CODE,
+        offsetof(SExprCode, constants)
+            + constant_count * sizeof(SExpr*)
+            + length
+    );
+    VM_FRAME_END(vm);
+
+    SExprCode* fields = (SExprCode*) code;
+    fields->source = source;
+    fields->params = params;
+    fields->max_stack = 0;
+    fields->length = length;
+    fields->cache_count = 0;
+    fields->epoch = vm->funcs_epoch;
+    fields->constant_count = constant_count;
+    for (size_t i = 0; i < constant_count; i++) {
+        fields->constants[i] = NIL;
+    }
+
+    return code;
+}
+
+// Returns the 16-bit operand starting at `offset`.
+static inline size_t vm_operand(const uint8_t* bytes, size_t offset) {
+    return (size_t) bytes[offset] | (size_t) bytes[offset + 1] << 8;
+}
+
+// Calls the builtin named by `id` with the values in `args`, which must be
+// rooted, pushing a frame for it like `eval_func` does.
+//
+// Leaf builtins run without a frame, and only get one if they fail so that
+// they still show up in the backtrace.
+static bool vm_call_builtin(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* id,
+    SExpr** args,
+    size_t arg_count,
+    SExpr** result
+) {
+    const BuiltinDef* builtin_def = lookup_builtin(id);
+    bool leaf = builtin_def->leaf;
+    if (!leaf && !eval_context_check_depth(vm, context)) return false;
+
+    // The result is kept apart from the arguments, since it's usually stored
+    // over the first of them.
+    SExpr* value = NIL;
+    VM_FRAME_BEGIN(vm, &context, &id, &value);
+
+    if (!leaf) eval_context_push_frame(vm, context, id, NIL);
+    bool success = builtin_def->func(vm, context, arg_count, args, &value);
+    if (!leaf) {
+        eval_context_pop_frame(vm, context);
+    } else if (!success) {
+        eval_context_push_frame(vm, context, id, NIL);
+    }
+
+    VM_FRAME_END(vm);
+    *result = value;
+    return success;
+}
+
+// Returns the result of an arithmetic or comparison instruction on two
+// numbers.
+static SExpr* vm_arithmetic(Vm* vm, OpCode op, double lhs, double rhs) {
+    bool comparison;
+    switch (op) {
+        case OP_ADD:
+            return vm_alloc_number(vm, lhs + rhs);
+        case OP_SUB:
+            return vm_alloc_number(vm, lhs - rhs);
+        case OP_MUL:
+            return vm_alloc_number(vm, lhs * rhs);
+        case OP_DIV:
+            return vm_alloc_number(vm, lhs / rhs);
+        case OP_LT:
+            comparison = lhs < rhs;
+            break;
+        case OP_GT:
+            comparison = lhs > rhs;
+            break;
+        case OP_LTE:
+            comparison = lhs <= rhs;
+            break;
+        case OP_GTE:
+            comparison = lhs >= rhs;
+            break;
+        default:
+            UNREACHABLE("invalid arithmetic opcode %u", op);
+    }
+
+    return comparison ? vm->t_symbol : NIL;
+}
+
+bool vm_execute(
+    Vm* vm,
+    EvalContext* context,
+    SExpr* code,
+    SExpr** result,
+    SExpr** tail
+) {
+    *tail = NULL;
+    if (!eval_context_binds(context, AS_CODE(code)->params)) {
+        *tail = AS_CODE(code)->source;
+        return true;
+    }
+
+    VM_FRAME_BEGIN(vm, &context, &code);
+
+    // The stack of the code is kept on the value stack of the VM.
+    size_t max_stack = AS_CODE(code)->max_stack;
+    GcFrame stack_frame;
+    SExpr** stack = vm_push_values(vm, &stack_frame, max_stack);
+
+    bool success = false;
+    size_t sp = 0;
+    size_t ip = 0;
+    while (true) {
+        // Any instruction that allocates can move the code, so its fields
+        // must be read before then.
+        SExprCode* fields = (SExprCode*) code;
+        const uint8_t* bytes = sexpr_code_bytes(fields);
+
+        OpCode op = (OpCode) bytes[ip];
+        switch (op) {
+            case OP_CONST:
+                stack[sp] = fields->constants[vm_operand(bytes, ip + 1)];
+                sp += 1;
+                ip += 3;
+                break;
+            case OP_LOCAL:
+                stack[sp] =
+                    eval_context_local(context, vm_operand(bytes, ip + 1));
+                sp += 1;
+                ip += 3;
+                break;
+            case OP_LOOKUP: {
+                SExpr* symbol = fields->constants[vm_operand(bytes, ip + 1)];
+                if (!eval_context_lookup(vm, context, symbol, &stack[sp])) {
+                    eval_context_symbol_lookup_failed(vm, context, symbol);
+                    goto cleanup;
+                }
+
+                sp += 1;
+                ip += 3;
+                break;
+            }
+            case OP_LET:
+                sp -= 1;
+                eval_context_add_symbol(
+                    vm,
+                    context,
+                    fields->constants[vm_operand(bytes, ip + 1)],
+                    stack[sp]
+                );
+                ip += 3;
+                break;
+            case OP_SET:
+                sp -= 1;
+                env_table_set(
+                    vm,
+                    &vm->vars,
+                    fields->constants[vm_operand(bytes, ip + 1)],
+                    stack[sp]
+                );
+                ip += 3;
+                break;
+            case OP_POP:
+                sp -= 1;
+                ip += 1;
+                break;
+            case OP_JUMP:
+                ip = vm_operand(bytes, ip + 1);
+                break;
+            case OP_JUMP_IF_NIL:
+                sp -= 1;
+                if (IS_NIL(stack[sp])) {
+                    ip = vm_operand(bytes, ip + 1);
+                } else {
+                    ip += 3;
+                }
+                break;
+            case OP_COND_FAIL: {
+                SExpr* id = fields->constants[vm_operand(bytes, ip + 1)];
+                eval_context_push_frame(vm, context, id, NIL);
+                eval_context_illegal_call(vm, context, NIL);
+                goto cleanup;
+            }
+            case OP_BUILTIN: {
+                size_t arg_count = vm_operand(bytes, ip + 3);
+                sp -= arg_count;
+
+                bool called = vm_call_builtin(
+                    vm,
+                    context,
+                    fields->constants[vm_operand(bytes, ip + 1)],
+                    &stack[sp],
+                    arg_count,
+                    &stack[sp]
+                );
+                if (!called) goto cleanup;
+
+                sp += 1;
+                ip += 5;
+                break;
+            }
+            case OP_ADD:
+            case OP_SUB:
+            case OP_MUL:
+            case OP_DIV:
+            case OP_LT:
+            case OP_GT:
+            case OP_LTE:
+            case OP_GTE: {
+                SExpr* lhs = stack[sp - 2];
+                SExpr* rhs = stack[sp - 1];
+                sp -= 2;
+
+                // Anything but two numbers is left to the builtin, which
+                // reports the error.
+                if (IS_NUMBER(lhs) && IS_NUMBER(rhs)) {
+                    stack[sp] = vm_arithmetic(
+                        vm,
+                        op,
+                        EXTRACT_NUMBER(lhs),
+                        EXTRACT_NUMBER(rhs)
+                    );
+                } else {
+                    bool called = vm_call_builtin(
+                        vm,
+                        context,
+                        fields->constants[vm_operand(bytes, ip + 1)],
+                        &stack[sp],
+                        2,
+                        &stack[sp]
+                    );
+                    if (!called) goto cleanup;
+                }
+
+                sp += 1;
+                ip += 3;
+                break;
+            }
+            case OP_NOT:
+                if (IS_NIL(stack[sp - 1])) {
+                    stack[sp - 1] = vm->t_symbol;
+                } else {
+                    stack[sp - 1] = NIL;
+                }
+                ip += 1;
+                break;
+            case OP_CONS:
+                stack[sp - 2] = vm_alloc_cons(vm, stack[sp - 2], stack[sp - 1]);
+                sp -= 1;
+                ip += 1;
+                break;
+            case OP_PREPARE: {
+                if (!eval_context_check_depth(vm, context)) goto cleanup;
+
+                SExpr* form = fields->constants[vm_operand(bytes, ip + 1)];
+                size_t arg_count = vm_operand(bytes, ip + 3);
+                SExpr** caches = &fields->constants[
+                    fields->constant_count - fields->cache_count
+                ];
+                SExpr** cache = &caches[vm_operand(bytes, ip + 5)];
+                ip += 7;
+
+                // Defining a function may change what any call refers to.
+                if (fields->epoch != vm->funcs_epoch) {
+                    for (size_t i = 0; i < fields->cache_count; i++) {
+                        caches[i] = NIL;
+                    }
+                    fields->epoch = vm->funcs_epoch;
+                }
+
+                SExpr* closure = *cache;
+                SExpr* id = EXTRACT_CAR(form);
+                if (IS_NIL(closure)) {
+                    if (!env_table_lookup(vm->funcs, id, &closure)) {
+                        eval_context_illegal_call(vm, context, form);
+                        goto cleanup;
+                    }
+
+                    *cache = closure;
+                    VM_WRITE_BARRIER(vm, code);
+                }
+
+                stack[sp] = closure;
+                sp += 1;
+                SExpr* params = AS_CLOSURE(closure)->params;
+                eval_context_push_frame(vm, context, id, params);
+
+                size_t arity = AS_CLOSURE(stack[sp - 1])->arity;
+                if (arity != arg_count) {
+                    eval_context_erronous_arg_count(context, arity);
+                    goto cleanup;
+                }
+                break;
+            }
+            case OP_CALL:
+            case OP_TAIL_CALL: {
+                sp -= vm_operand(bytes, ip + 1);
+                eval_context_bind_locals(vm, context, &stack[sp]);
+                sp -= 1;
+
+                SExpr* body = AS_CLOSURE(stack[sp])->body;
+                if (op == OP_TAIL_CALL) {
+                    // The callee's body finishes this call. Compiled bodies
+                    // that fit on the stack are run by this loop if the
+                    // callee's frame can replace this one, and the others
+                    // are left to the caller along with the callee's frame.
+                    bool loop = IS_CODE(body)
+                        && AS_CODE(body)->max_stack <= max_stack
+                        && eval_context_binds(context, AS_CODE(body)->params)
+                        && eval_context_replace_caller(vm, context);
+                    if (!loop) {
+                        *tail = body;
+                        success = true;
+                        goto cleanup;
+                    }
+
+                    code = body;
+                    sp = 0;
+                    ip = 0;
+                    break;
+                }
+
+                bool called = eval_internal(vm, context, body, &stack[sp]);
+                eval_context_pop_frame(vm, context);
+                if (!called) goto cleanup;
+
+                sp += 1;
+                ip += 3;
+                break;
+            }
+            case OP_EVAL: {
+                SExpr* form = fields->constants[vm_operand(bytes, ip + 1)];
+
+                // A form whose value is returned is left to the caller.
+                if ((OpCode) bytes[ip + 3] == OP_RETURN) {
+                    *result = NIL;
+                    *tail = form;
+                    success = true;
+                    goto cleanup;
+                }
+
+                // Not every builtin sets its result.
+                stack[sp] = NIL;
+                if (!eval_internal(vm, context, form, &stack[sp])) {
+                    goto cleanup;
+                }
+
+                sp += 1;
+                ip += 3;
+                break;
+            }
+            case OP_RETURN:
+                *result = stack[sp - 1];
+                success = true;
+                goto cleanup;
+            default:
+                UNREACHABLE("invalid opcode %u", op);
+        }
+    }
+
+cleanup:
+    vm_pop_values(vm, &stack_frame);
+    VM_FRAME_END(vm);
+
+    return success;
+}
+
 void env_init(Vm* vm, Environment* env) {
     SExpr* values = vm_alloc_cons(vm, NIL, NIL);
     env->list = vm_alloc_cons(vm, NIL, values);
 }
 
-void env_free(Environment* env) {
-    env->list = NULL;
-}
-
 void env_set(Vm* vm, Environment* env, SExpr* symbol, SExpr* value) {
     SExpr* list = env->list;
-    VM_ROOT(vm, &list);
-    VM_ROOT(vm, &symbol);
+    SExpr* value_cons = NULL;
+    VM_FRAME_BEGIN(vm, &list, &symbol, &value_cons);
 
-    SExpr* value_cons = vm_alloc_cons(
+    value_cons = vm_alloc_cons(
         vm,
         value,
         EXTRACT_CAR(EXTRACT_CDR(list))
     );
 
-    VM_UNROOT(vm, &symbol);
-    VM_ROOT(vm, &value_cons);
-
     SExpr* symbol_cons = vm_alloc_cons(
         vm,
         symbol,
         EXTRACT_CAR(list)
     );
 
-    VM_UNROOT(vm, &value_cons);
-    VM_UNROOT(vm, &list);
+    VM_FRAME_END(vm);
 
     AS_CONS(list)->car = symbol_cons;
+    VM_WRITE_BARRIER(vm, list);
     AS_CONS(AS_CONS(list)->cdr)->car = value_cons;
+    VM_WRITE_BARRIER(vm, AS_CONS(list)->cdr);
 }
 
 bool env_lookup(Environment* env, SExpr* symbol, SExpr** value) {
@@ -126,7 +815,7 @@ bool env_lookup(Environment* env, SExpr* symbol, SExpr** value) {
 
     while (!IS_NIL(symbols)) {
         SExpr* test_symbol = EXTRACT_CAR(symbols);
-        if (s8_equals(EXTRACT_SYMBOL(test_symbol), EXTRACT_SYMBOL(symbol))) {
+        if (test_symbol == symbol) {
             *value = EXTRACT_CAR(values);
             return true;
         }
@@ -138,14 +827,118 @@ bool env_lookup(Environment* env, SExpr* symbol, SExpr** value) {
     return false;
 }
 
+static size_t env_table_size(GcObject* object) {
+    return offsetof(EnvTable, entries)
+        + ((EnvTable*) object)->capacity * sizeof(EnvEntry);
+}
+
+static void env_table_scan(Gc* gc, GcObject* object) {
+    EnvTable* table = (EnvTable*) object;
+    for (size_t i = 0; i < table->capacity; i++) {
+        GC_SCAN_FIELD(gc, table->entries[i].symbol);
+        GC_SCAN_FIELD(gc, table->entries[i].value);
+    }
+}
+
+static void gc_add_env_table(Gc* gc) {
+    size_t type_id = gc_add_type(
+        gc,
+        alignof(EnvTable),
+        env_table_size,
+        env_table_scan
+    );
+
+    ASSERT(type_id == ENV_TABLE_TYPE_ID);
+}
+
+static EnvTable* env_table_alloc(Vm* vm, size_t capacity) {
+    EnvTable* table = (EnvTable*) gc_alloc(
+        &vm->gc,
+        ENV_TABLE_TYPE_ID,
+        offsetof(EnvTable, entries) + capacity * sizeof(EnvEntry)
+    );
+
+    table->count = 0;
+    table->capacity = capacity;
+    for (size_t i = 0; i < capacity; i++) {
+        table->entries[i].symbol = NIL;
+        table->entries[i].value = NIL;
+    }
+
+    return table;
+}
+
+// Returns the entry binding `symbol`, or the empty entry where it should be
+// inserted. The entry is only valid until the next allocation.
+static EnvEntry* env_table_entry(EnvTable* table, SExpr* symbol) {
+    size_t mask = table->capacity - 1;
+    size_t index = AS_SYMBOL(symbol)->hash & mask;
+
+    while (table->entries[index].symbol != NIL
+        && table->entries[index].symbol != symbol
+    ) {
+        index = (index + 1) & mask;
+    }
+
+    return &table->entries[index];
+}
+
+static void env_table_grow(Vm* vm, EnvTable** table) {
+    EnvTable* grown = env_table_alloc(vm, (*table)->capacity * 2);
+    EnvTable* old = *table;
+
+    for (size_t i = 0; i < old->capacity; i++) {
+        if (old->entries[i].symbol == NIL) continue;
+
+        *env_table_entry(grown, old->entries[i].symbol) = old->entries[i];
+    }
+
+    grown->count = old->count;
+    VM_WRITE_BARRIER(vm, grown);
+    *table = grown;
+}
+
+void env_table_set(Vm* vm, EnvTable** table, SExpr* symbol, SExpr* value) {
+    EnvEntry* entry = env_table_entry(*table, symbol);
+    if (entry->symbol == NIL) {
+        // Keep the table at most half full so that probe sequences stay short.
+        if (((*table)->count + 1) * 2 > (*table)->capacity) {
+            VM_FRAME_BEGIN(vm, &symbol, &value);
+            env_table_grow(vm, table);
+            VM_FRAME_END(vm);
+
+            entry = env_table_entry(*table, symbol);
+        }
+
+        entry->symbol = symbol;
+        (*table)->count += 1;
+    }
+
+    entry->value = value;
+    VM_WRITE_BARRIER(vm, *table);
+}
+
+bool env_table_lookup(EnvTable* table, SExpr* symbol, SExpr** value) {
+    EnvEntry* entry = env_table_entry(table, symbol);
+    if (entry->symbol == NIL) {
+        return false;
+    }
+
+    *value = entry->value;
+    return true;
+}
+
 #ifdef ENABLE_TESTS
 
+#include <math.h>
+#include <string.h>
+
 #include "test.h"
 #include "util.h"
 
 bool vm_env_set_lookup_basic() {
     Vm vm;
-    if (!vm_init(&vm)) {
+    if (!vm_init(&vm, NULL)) {
         return false;
     }
 
@@ -160,10 +953,10 @@ bool vm_env_set_lookup_basic() {
     symbol = vm_alloc_symbol(&vm, s8("test"));
     value = vm_alloc_number(&vm, 1.0);
 
-    env_set(&vm, &vm.vars, symbol, value);
+    env_table_set(&vm, &vm.vars, symbol, value);
 
-    bool found = env_lookup(&vm.vars, symbol, &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 1.0) {
+    bool found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 1.0) {
         goto cleanup;
     }
 
@@ -175,7 +968,7 @@ cleanup:
 
 bool vm_env_set_lookup_override() {
     Vm vm;
-    if (!vm_init(&vm)) {
+    if (!vm_init(&vm, NULL)) {
         return false;
     }
 
@@ -190,19 +983,19 @@ bool vm_env_set_lookup_override() {
     symbol = vm_alloc_symbol(&vm, s8("test"));
     value = vm_alloc_number(&vm, 1.0);
 
-    env_set(&vm, &vm.vars, symbol, value);
+    env_table_set(&vm, &vm.vars, symbol, value);
 
-    bool found = env_lookup(&vm.vars, symbol, &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 1.0) {
+    bool found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 1.0) {
         goto cleanup;
     }
 
     value = vm_alloc_number(&vm, 2.0);
 
-    env_set(&vm, &vm.vars, symbol, value);
+    env_table_set(&vm, &vm.vars, symbol, value);
 
-    found = env_lookup(&vm.vars, symbol, &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 2.0) {
+    found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 2.0) {
         goto cleanup;
     }
 
@@ -214,7 +1007,7 @@ cleanup:
 
 bool vm_env_set_lookup_multi_support() {
     Vm vm;
-    if (!vm_init(&vm)) {
+    if (!vm_init(&vm, NULL)) {
         return false;
     }
 
@@ -229,28 +1022,203 @@ bool vm_env_set_lookup_multi_support() {
     symbol = vm_alloc_symbol(&vm, s8("test"));
     value = vm_alloc_number(&vm, 1.0);
 
-    env_set(&vm, &vm.vars, symbol, value);
+    env_table_set(&vm, &vm.vars, symbol, value);
 
-    bool found = env_lookup(&vm.vars, symbol, &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 1.0) {
+    bool found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 1.0) {
         goto cleanup;
     }
 
     symbol = vm_alloc_symbol(&vm, s8("toads"));
     value = vm_alloc_number(&vm, 2.0);
 
-    env_set(&vm, &vm.vars, symbol, value);
+    env_table_set(&vm, &vm.vars, symbol, value);
 
-    found = env_lookup(&vm.vars, symbol, &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 2.0) {
+    found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 2.0) {
         goto cleanup;
     }
 
-    found = env_lookup(&vm.vars, vm_alloc_symbol(&vm, s8("test")), &value);
-    if (!found || !IS_NUMBER(value) || AS_NUMBER(value)->number != 1.0) {
+    symbol = vm_alloc_symbol(&vm, s8("test"));
+    found = env_table_lookup(vm.vars, symbol, &value);
+    if (!found || !IS_NUMBER(value) || EXTRACT_NUMBER(value) != 1.0) {
+        goto cleanup;
+    }
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool vm_numbers_round_trip() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    double numbers[] = {
+        0.0, -0.0, 1.0, -1.0, 0.1, 1e10, -1e-10, 1e300, 1e-300, INFINITY,
+    };
+
+    SExpr* number = NULL;
+    VM_ROOT(&vm, &number);
+    for (size_t i = 0; i < countof(numbers); i++) {
+        number = vm_alloc_number(&vm, numbers[i]);
+        gc_collect(&vm.gc);
+
+        if (!IS_NUMBER(number)) goto cleanup;
+        double value = EXTRACT_NUMBER(number);
+        if (memcmp(&value, &numbers[i], sizeof(double)) != 0) goto cleanup;
+    }
+
+#ifdef SEXPR_IMMEDIATE_NUMBERS
+    // Common numbers shouldn't need to be allocated.
+    size_t allocated = vm.gc.stats.bytes_allocated;
+    for (size_t i = 0; i < 1000; i++) {
+        number = vm_alloc_number(&vm, (double) i * 0.5);
+    }
+
+    if (vm.gc.stats.bytes_allocated != allocated) goto cleanup;
+#endif
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool vm_symbols_are_interned() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    SExpr* first = NULL;
+    VM_ROOT(&vm, &first);
+
+    // Some symbols are interned by the VM itself.
+    size_t initial_count = vm.symbols->count;
+    first = vm_alloc_symbol(&vm, s8("symbol-0"));
+
+    // Enough symbols to grow the table a few times.
+    char name[32];
+    for (size_t i = 1; i < 2000; i++) {
+        int len = snprintf(name, sizeof(name), "symbol-%zu", i);
+        vm_alloc_symbol(&vm, (s8) { (uint8_t*) name, (size_t) len });
+    }
+
+    gc_collect(&vm.gc);
+
+    if (vm.symbols->count != initial_count + 2000) goto cleanup;
+    if (vm_alloc_symbol(&vm, s8("symbol-0")) != first) goto cleanup;
+    if (vm_find_symbol(&vm, s8("symbol-0")) != first) goto cleanup;
+    if (vm_find_symbol(&vm, s8("symbol-2000")) != NIL) goto cleanup;
+
+    for (size_t i = 0; i < 2000; i++) {
+        int len = snprintf(name, sizeof(name), "symbol-%zu", i);
+        s8 s = { (uint8_t*) name, (size_t) len };
+
+        SExpr* symbol = vm_find_symbol(&vm, s);
+        if (symbol == NIL || !s8_equals(EXTRACT_SYMBOL(symbol), s)) {
+            goto cleanup;
+        }
+    }
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool vm_singleton_symbols_are_interned() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    gc_collect(&vm.gc);
+
+    // The singletons follow the symbols they name when they're moved.
+    if (vm_find_symbol(&vm, s8("t")) != vm.t_symbol) goto cleanup;
+    if (vm_find_symbol(&vm, s8("lambda")) != vm.lambda_symbol) goto cleanup;
+    if (vm_find_symbol(&vm, s8("begin")) != vm.begin_symbol) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool vm_env_table_updates_in_place() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    SExpr* symbol = NULL;
+    SExpr* value = NULL;
+    VM_ROOT(&vm, &symbol);
+    VM_ROOT(&vm, &value);
+
+    // Enough bindings to grow the table a few times, each set twice.
+    char name[32];
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < 1000; i++) {
+            int len = snprintf(name, sizeof(name), "var-%zu", i);
+            symbol = vm_alloc_symbol(&vm, (s8) { (uint8_t*) name, (size_t) len });
+            value = vm_alloc_number(&vm, (double) (i + pass * 1000));
+            env_table_set(&vm, &vm.vars, symbol, value);
+        }
+    }
+
+    gc_collect(&vm.gc);
+
+    if (vm.vars->count != 1000) goto cleanup;
+    for (size_t i = 0; i < 1000; i++) {
+        int len = snprintf(name, sizeof(name), "var-%zu", i);
+        symbol = vm_alloc_symbol(&vm, (s8) { (uint8_t*) name, (size_t) len });
+
+        bool found = env_table_lookup(vm.vars, symbol, &value);
+        if (!found || EXTRACT_NUMBER(value) != (double) (i + 1000)) {
+            goto cleanup;
+        }
+    }
+
+    symbol = vm_alloc_symbol(&vm, s8("var-1000"));
+    if (env_table_lookup(vm.vars, symbol, &value)) goto cleanup;
+
+    result = true;
+cleanup:
+    vm_free(&vm);
+    return result;
+}
+
+bool vm_symbols_cache_builtins() {
+    Vm vm;
+    if (!vm_init(&vm, NULL)) {
+        return false;
+    }
+
+    bool result = false;
+
+    SExpr* symbol = vm_alloc_symbol(&vm, s8("cons"));
+    const BuiltinDef* builtin = lookup_builtin(symbol);
+    if (builtin == NULL || !s8_equals(builtin->name, s8("cons"))) {
         goto cleanup;
     }
 
+    symbol = vm_alloc_symbol(&vm, s8("conses"));
+    if (lookup_builtin(symbol) != NULL) goto cleanup;
+
     result = true;
 cleanup:
     vm_free(&vm);
@@ -261,6 +1229,11 @@ TestDefinition vm_tests[] = {
     DEFINE_UNIT_TEST(vm_env_set_lookup_basic, 5),
     DEFINE_UNIT_TEST(vm_env_set_lookup_override, 5),
     DEFINE_UNIT_TEST(vm_env_set_lookup_multi_support, 5),
+    DEFINE_UNIT_TEST(vm_numbers_round_trip, 0),
+    DEFINE_UNIT_TEST(vm_symbols_are_interned, 0),
+    DEFINE_UNIT_TEST(vm_singleton_symbols_are_interned, 0),
+    DEFINE_UNIT_TEST(vm_env_table_updates_in_place, 0),
+    DEFINE_UNIT_TEST(vm_symbols_cache_builtins, 0),
 };
 
 TestList vm_test_list = (TestList) {